@@ -0,0 +1,91 @@
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+
+#include <atomic>
+#include <cstdint>
+
+// Heap allocation counters, for checking that the frame loop is allocation
+// free in steady state. Built with -DCOUNT_ALLOCS (make allocs) it replaces
+// the global operator new and installs a cv::Mat allocator that counts every
+// buffer OpenCV allocates; otherwise the counts simply stay at zero. Every
+// allocation is counted for the whole process and for the thread making it,
+// so the frame loop's own count isn't mixed up with the capture and writer
+// threads running next to it.
+//
+// The replacement operators are defined here, so this header must be
+// included by exactly one translation unit (main.cpp).
+
+// all threads
+inline std::atomic<uint64_t> & allocCount() {
+	static std::atomic<uint64_t> count(0);
+	return count;
+}
+
+// the calling thread
+inline uint64_t & threadAllocCount() {
+	static thread_local uint64_t count = 0;
+	return count;
+}
+
+inline void countAlloc() {
+	allocCount()++;
+	threadAllocCount()++;
+}
+
+#ifdef COUNT_ALLOCS
+
+#include <opencv2/opencv.hpp>
+
+#include <cstdlib>
+#include <new>
+
+void * operator new(std::size_t n) {
+	countAlloc();
+	void * p = std::malloc(n ? n : 1);
+	if (!p) throw std::bad_alloc();
+	return p;
+}
+
+void * operator new[](std::size_t n) {
+	return operator new(n);
+}
+
+void operator delete(void * p) noexcept {
+	std::free(p);
+}
+
+void operator delete[](void * p) noexcept {
+	std::free(p);
+}
+
+// Counts and forwards to OpenCV's own allocator. The buffers it returns
+// still belong to the standard allocator, so releasing them is unchanged.
+class counting_mat_allocator : public cv::MatAllocator {
+public:
+	cv::UMatData * allocate(int dims, const int * sizes, int type, void * data, size_t * step,
+			int flags, cv::UMatUsageFlags usage) const {
+		if (!data) countAlloc();
+		return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usage);
+	}
+
+	bool allocate(cv::UMatData * u, int access, cv::UMatUsageFlags usage) const {
+		return cv::Mat::getStdAllocator()->allocate(u, access, usage);
+	}
+
+	void deallocate(cv::UMatData * u) const {
+		cv::Mat::getStdAllocator()->deallocate(u);
+	}
+};
+
+inline void installAllocCounter() {
+	static counting_mat_allocator allocator;
+	cv::Mat::setDefaultAllocator(&allocator);
+}
+
+#else
+
+inline void installAllocCounter() {}
+
+#endif
+
+#endif
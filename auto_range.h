@@ -0,0 +1,65 @@
+#ifndef AUTO_RANGE_H
+#define AUTO_RANGE_H
+
+#include <cmath>
+
+#include "depth_hist.h"
+
+// Continuous auto range. Follows the low/high percentiles of the per-frame
+// depth histogram through an exponential moving average, and only reports a
+// new range once the smoothed bounds move by more than one histogram bin, so
+// the colormap doesn't flicker.
+class auto_range {
+public:
+	auto_range(double low = 0.001, double high = 0.999, double alpha = 0.1) :
+		enabled(false), low_p(low), high_p(high), alpha(alpha),
+		lo(0), hi(0), primed(false), out_min(0), out_max(0)
+	{
+	}
+
+	void toggle() {
+		enabled = !enabled;
+		primed = false;
+	}
+
+	// Feed the current histogram, returns true if min()/range() changed.
+	bool update(const depth_hist & hist) {
+		if (!enabled || hist.total() == 0) return false;
+
+		double l = hist.percentile(low_p);
+		double h = hist.percentile(high_p);
+		if (!primed) {
+			lo = l;
+			hi = h;
+			primed = true;
+		} else {
+			lo += alpha * (l - lo);
+			hi += alpha * (h - hi);
+		}
+
+		int step = hist.binWidth();
+		int new_min = step * (int)std::floor(lo / step);
+		int new_max = step * (int)std::ceil(hi / step);
+		if (std::abs(new_min - out_min) < step && std::abs(new_max - out_max) < step) return false;
+		out_min = new_min;
+		out_max = new_max;
+		return true;
+	}
+
+	bool enabled;
+
+	// smoothed percentile bounds in mm
+	double low() const { return lo; }
+	double high() const { return hi; }
+
+	int min() const { return out_min; }
+	int range() const { return out_max - out_min; }
+
+private:
+	double low_p, high_p, alpha;
+	double lo, hi;
+	bool primed;
+	int out_min, out_max;
+};
+
+#endif
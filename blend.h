@@ -0,0 +1,140 @@
+#ifndef BLEND_H
+#define BLEND_H
+
+#include <opencv2/opencv.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Depth-range masking and RGB blending in one pass.
+//
+// Pixels with valid depth inside [dmin, dmax] keep their color, all others
+// are dimmed to blend/256 of it. That is what the old copyTo(depth_mask) +
+// addWeighted pair computed, but it reads depth and RGB once and uses 8.8
+// fixed point instead of per-channel float math.
+
+inline int blendWeight(int blend_ratio) {
+	return (std::min(std::max(blend_ratio, 0), 100) * 256 + 50) / 100;
+}
+
+inline void maskBlendRowScalar(const uint16_t * depth, const uint8_t * rgb, uint8_t * out, int n,
+		uint16_t dmin, uint16_t dmax, int weight) {
+	for (int x = 0; x < n; ++x) {
+		uint16_t d = depth[x];
+		const uint8_t * s = rgb + x * 3;
+		uint8_t * o = out + x * 3;
+		if (d != 0 && d >= dmin && d <= dmax) {
+			o[0] = s[0];
+			o[1] = s[1];
+			o[2] = s[2];
+		} else {
+			o[0] = (s[0] * weight + 128) >> 8;
+			o[1] = (s[1] * weight + 128) >> 8;
+			o[2] = (s[2] * weight + 128) >> 8;
+		}
+	}
+}
+
+#ifdef __SSE2__
+// 8 pixel mask bits -> 24 byte mask, one 0xff/0x00 byte per channel.
+struct blend_mask_lut {
+	blend_mask_lut() {
+		for (int m = 0; m < 256; ++m) {
+			for (int i = 0; i < 24; ++i) {
+				bytes[m][i] = (m >> (i / 3)) & 1 ? 0xff : 0x00;
+			}
+		}
+	}
+
+	uint8_t bytes[256][24];
+};
+
+// Mask bits (bit i = pixel i in range) for 16 pixels.
+inline int maskBits16(const uint16_t * depth, __m128i vmin, __m128i vmax) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i d0 = _mm_loadu_si128((const __m128i *)depth);
+	__m128i d1 = _mm_loadu_si128((const __m128i *)(depth + 8));
+	// saturating differences are zero exactly when dmin <= d <= dmax
+	__m128i o0 = _mm_or_si128(_mm_subs_epu16(d0, vmax), _mm_subs_epu16(vmin, d0));
+	__m128i o1 = _mm_or_si128(_mm_subs_epu16(d1, vmax), _mm_subs_epu16(vmin, d1));
+	__m128i in0 = _mm_andnot_si128(_mm_cmpeq_epi16(d0, zero), _mm_cmpeq_epi16(o0, zero));
+	__m128i in1 = _mm_andnot_si128(_mm_cmpeq_epi16(d1, zero), _mm_cmpeq_epi16(o1, zero));
+	return _mm_movemask_epi8(_mm_packs_epi16(in0, in1));
+}
+
+inline __m128i dim16(__m128i v, __m128i w, __m128i half) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i lo = _mm_unpacklo_epi8(v, zero);
+	__m128i hi = _mm_unpackhi_epi8(v, zero);
+	lo = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(lo, w), half), 8);
+	hi = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(hi, w), half), 8);
+	return _mm_packus_epi16(lo, hi);
+}
+#endif
+
+inline void maskBlendRow(const uint16_t * depth, const uint8_t * rgb, uint8_t * out, int n,
+		uint16_t dmin, uint16_t dmax, int weight) {
+	int x = 0;
+#ifdef __SSE2__
+	static const blend_mask_lut lut;
+	__m128i vmin = _mm_set1_epi16((short)dmin);
+	__m128i vmax = _mm_set1_epi16((short)dmax);
+	__m128i w = _mm_set1_epi16((short)weight);
+	__m128i half = _mm_set1_epi16(128);
+	for (; x + 16 <= n; x += 16) {
+		const uint8_t * s = rgb + x * 3;
+		uint8_t * o = out + x * 3;
+		int bits = maskBits16(depth + x, vmin, vmax);
+
+		__m128i s0 = _mm_loadu_si128((const __m128i *)s);
+		__m128i s1 = _mm_loadu_si128((const __m128i *)(s + 16));
+		__m128i s2 = _mm_loadu_si128((const __m128i *)(s + 32));
+		if (bits == 0xffff) {
+			_mm_storeu_si128((__m128i *)o, s0);
+			_mm_storeu_si128((__m128i *)(o + 16), s1);
+			_mm_storeu_si128((__m128i *)(o + 32), s2);
+			continue;
+		}
+
+		__m128i d0 = dim16(s0, w, half);
+		__m128i d1 = dim16(s1, w, half);
+		__m128i d2 = dim16(s2, w, half);
+		if (bits != 0) {
+			uint8_t m[48];
+			std::memcpy(m, lut.bytes[bits & 0xff], 24);
+			std::memcpy(m + 24, lut.bytes[bits >> 8], 24);
+			__m128i m0 = _mm_loadu_si128((const __m128i *)m);
+			__m128i m1 = _mm_loadu_si128((const __m128i *)(m + 16));
+			__m128i m2 = _mm_loadu_si128((const __m128i *)(m + 32));
+			d0 = _mm_or_si128(_mm_and_si128(m0, s0), _mm_andnot_si128(m0, d0));
+			d1 = _mm_or_si128(_mm_and_si128(m1, s1), _mm_andnot_si128(m1, d1));
+			d2 = _mm_or_si128(_mm_and_si128(m2, s2), _mm_andnot_si128(m2, d2));
+		}
+		_mm_storeu_si128((__m128i *)o, d0);
+		_mm_storeu_si128((__m128i *)(o + 16), d1);
+		_mm_storeu_si128((__m128i *)(o + 32), d2);
+	}
+#endif
+	maskBlendRowScalar(depth + x, rgb + x * 3, out + x * 3, n - x, dmin, dmax, weight);
+}
+
+// out = rgb where depth_min <= depth <= depth_min + depth_range (and valid),
+// rgb dimmed by blend_ratio percent elsewhere.
+inline void maskBlend(const cv::Mat & depth, const cv::Mat & rgb, cv::Mat & out,
+		int depth_min, int depth_range, int blend_ratio) {
+	CV_Assert(depth.type() == CV_16UC1 && rgb.type() == CV_8UC3 && depth.size() == rgb.size());
+	out.create(rgb.size(), CV_8UC3);
+	uint16_t dmin = std::min(std::max(depth_min, 0), 65535);
+	uint16_t dmax = std::min(std::max(depth_min + depth_range, 0), 65535);
+	int weight = blendWeight(blend_ratio);
+	for (int y = 0; y < rgb.rows; ++y) {
+		maskBlendRow(depth.ptr<uint16_t>(y), rgb.ptr<uint8_t>(y), out.ptr<uint8_t>(y), rgb.cols, dmin, dmax, weight);
+	}
+}
+
+#endif
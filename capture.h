@@ -0,0 +1,106 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "frame.h"
+#include "frame_pool.h"
+#include "frame_ring.h"
+#include "frame_source.h"
+#include "pretrigger.h"
+#include "recording.h"
+
+// Acquisition thread. Owns the frame source and publishes every frame pair
+// to the ring, so the UI can take as long as it likes without back-pressuring
+// the sensor; only lossless sources wait for room in the ring. Frames are grabbed straight into pool slots; the ring, the
+// recorder and whoever else wants the frame share it by reference.
+class capture {
+public:
+	capture(frame_ring<frame_ref> & ring, frame_pool & pool) :
+		ring(ring), pool(pool), source(nullptr), rec(nullptr), pre(nullptr),
+		running(false), failed_flag(false), finished_flag(false)
+	{
+	}
+
+	~capture() {
+		stop();
+	}
+
+	void setSource(frame_source * s) {
+		source = s;
+	}
+
+	// Every grabbed frame is also handed to the recorder, independently of
+	// whether the UI keeps up with the ring.
+	void recordTo(recorder * r) {
+		rec = r;
+	}
+
+	// Same for the pre-trigger buffer.
+	void bufferTo(pretrigger * p) {
+		pre = p;
+	}
+
+	void start() {
+		running = true;
+		worker = std::thread(&capture::run, this);
+	}
+
+	void stop() {
+		running = false;
+		if (worker.joinable()) worker.join();
+	}
+
+	bool failed() const { return failed_flag; }
+
+	// source has no more frames (end of a recording)
+	bool finished() const { return finished_flag; }
+
+private:
+	void run() {
+		while (running) {
+			// With every slot still held downstream the source is drained
+			// into scratch and the frame is lost, the sensor never waits.
+			frame_ref ref = pool.acquire();
+			frame & f = ref ? *ref : scratch;
+			f.convert_ms = 0;
+			auto start = std::chrono::steady_clock::now();
+			frame_source::result r = source->grab(f);
+			f.grab_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+			if (r == frame_source::IDLE) continue;
+			if (r == frame_source::FAILED) {
+				failed_flag = true;
+				break;
+			}
+			if (r == frame_source::END) {
+				finished_flag = true;
+				break;
+			}
+			if (!ref) continue;
+			if (rec) rec->write(ref);
+			if (pre) pre->push(ref);
+			while (source->lossless() && ring.full() && running) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+			ring.back() = std::move(ref);
+			ring.push();
+		}
+		source->close();
+	}
+
+	frame_ring<frame_ref> & ring;
+	frame_pool & pool;
+	frame scratch;
+	frame_source * source;
+	recorder * rec;
+	pretrigger * pre;
+
+	std::thread worker;
+	std::atomic<bool> running;
+	std::atomic<bool> failed_flag;
+	std::atomic<bool> finished_flag;
+};
+
+#endif
@@ -0,0 +1,99 @@
+// Depth codec against PNG on recorded frames:
+//   codec_bench session.kvr [more.kvr|depth.png|depth.kvd ...]
+
+#include <opencv2/opencv.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "depth_codec.h"
+#include "frame.h"
+#include "playback.h"
+
+struct codec_total {
+	codec_total() : bytes(0), enc_s(0), dec_s(0) {}
+
+	void print(const char * name, size_t frames, size_t raw) const {
+		std::printf("%-4s %9.0f bytes/frame  %5.1f%% of raw  encode %6.2f ms (%4.0f fps)  decode %6.2f ms (%4.0f fps)\n",
+			name, double(bytes) / frames, 100.0 * bytes / raw,
+			1000 * enc_s / frames, frames / enc_s, 1000 * dec_s / frames, frames / dec_s);
+	}
+
+	size_t bytes;
+	double enc_s, dec_s;
+};
+
+static double seconds(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char * argv[]) {
+	if (argc < 2) {
+		std::cerr << "usage: codec_bench <recording.kvr|depth.png|depth.kvd>..." << std::endl;
+		return 1;
+	}
+
+	// every depth frame of the inputs, copied out of the mappings
+	std::vector<cv::Mat> frames;
+	for (int i = 1; i < argc; ++i) {
+		std::string path = argv[i];
+		std::string ext = path.size() > 4 ? path.substr(path.size() - 4) : "";
+		if (ext == ".kvr") {
+			playback rec;
+			if (!rec.open(path)) return 1;
+			frame f;
+			for (size_t j = 0; j < rec.size(); ++j) {
+				rec.view(j, f);
+				frames.push_back(f.depth.clone());
+			}
+		} else {
+			cv::Mat depth;
+			if (ext == ".kvd") readDepthFile(path, depth);
+			else depth = cv::imread(path, cv::IMREAD_UNCHANGED);
+			if (depth.type() != CV_16UC1) {
+				std::cerr << "Not a 16-bit depth image: " << path << std::endl;
+				return 1;
+			}
+			frames.push_back(depth);
+		}
+	}
+	if (frames.empty()) {
+		std::cerr << "No frames" << std::endl;
+		return 1;
+	}
+
+	size_t raw = 0;
+	codec_total kvd, png;
+	std::vector<uint8_t> buf;
+	cv::Mat decoded;
+	for (const cv::Mat & depth : frames) {
+		raw += depth.total() * depth.elemSize();
+
+		auto start = std::chrono::steady_clock::now();
+		kvd.bytes += depth_codec::encode(depth, buf);
+		kvd.enc_s += seconds(start);
+		start = std::chrono::steady_clock::now();
+		bool ok = depth_codec::decode(buf, decoded);
+		kvd.dec_s += seconds(start);
+		if (!ok || cv::countNonZero(decoded != depth) != 0) {
+			std::cerr << "kvd round trip failed" << std::endl;
+			return 1;
+		}
+
+		start = std::chrono::steady_clock::now();
+		cv::imencode(".png", depth, buf);
+		png.enc_s += seconds(start);
+		png.bytes += buf.size();
+		start = std::chrono::steady_clock::now();
+		decoded = cv::imdecode(buf, cv::IMREAD_UNCHANGED);
+		png.dec_s += seconds(start);
+	}
+
+	std::printf("%zu frames, %.0f raw bytes/frame\n", frames.size(), double(raw) / frames.size());
+	kvd.print("kvd", frames.size(), raw);
+	png.print("png", frames.size(), raw);
+	return 0;
+}
@@ -0,0 +1,41 @@
+#ifndef COMMANDS_H
+#define COMMANDS_H
+
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Reads control commands from stdin on a background thread, one per line.
+// The frame loop drains them with poll() between frames.
+class command_reader {
+public:
+	void start() {
+		// std::getline can't be interrupted, the thread just dies with the process
+		std::thread(&command_reader::run, this).detach();
+	}
+
+	bool poll(std::string & cmd) {
+		std::lock_guard<std::mutex> lock(mtx);
+		if (queue.empty()) return false;
+		cmd = queue.front();
+		queue.pop_front();
+		return true;
+	}
+
+private:
+	void run() {
+		std::string line;
+		while (std::getline(std::cin, line)) {
+			if (line.empty()) continue;
+			std::lock_guard<std::mutex> lock(mtx);
+			queue.push_back(line);
+		}
+	}
+
+	std::mutex mtx;
+	std::deque<std::string> queue;
+};
+
+#endif
@@ -0,0 +1,304 @@
+#ifndef DEPTH_CODEC_H
+#define DEPTH_CODEC_H
+
+#include <opencv2/opencv.hpp>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Lossless codec for 16-bit depth (.kvd).
+//
+// Every pixel is predicted from its decoded neighbours: left + up - upleft
+// where all three are valid, else left, up, or the last valid value. The
+// residual is zig-zag mapped to an unsigned symbol s + 1, so symbol 0 is
+// free to start a run of invalid (0) pixels, whose length follows. Symbols
+// and run lengths are Rice coded, each with a parameter adapted to the
+// running mean of what it coded so far, which keeps smooth surfaces near
+// 2-3 bits per pixel. Bits are packed LSB first through a 64-bit
+// accumulator, and the decoder reads unary prefixes with one count trailing
+// zeros, no tables and nothing allocated per frame.
+//
+// Stream: 16-byte header (magic, width, height, reserved), then the bits of
+// all rows, zero padded to whole bytes.
+
+static const char KVD_MAGIC[4] = { 'K', 'V', 'D', '1' };
+static const size_t KVD_HEADER = 16;
+static const size_t KVD_MAX_PIXELS = 4096 * 4096;  // 32 MB decoded
+
+class depth_codec {
+public:
+	// Replaces out with the encoded frame and returns its size. Encodes into
+	// a per-thread buffer of maxSize() that only grows, so nothing is
+	// allocated or cleared per frame once out has room for a frame.
+	static size_t encode(const cv::Mat & depth, std::vector<uint8_t> & out) {
+		static thread_local std::vector<uint8_t> scratch;
+		size_t max = maxSize(depth.cols, depth.rows);
+		if (scratch.size() < max) scratch.resize(max);
+		size_t size = encode(depth, &scratch[0]);
+		out.assign(scratch.begin(), scratch.begin() + size);
+		return size;
+	}
+
+	// Encodes into dst, which has room for maxSize(), and returns the size.
+	static size_t encode(const cv::Mat & depth, uint8_t * dst) {
+		CV_Assert(depth.type() == CV_16UC1);
+		int w = depth.cols, h = depth.rows;
+		writeHeader(dst, w, h);
+
+		bit_writer bits(dst + KVD_HEADER);
+		adaptive vals, runs;
+		int last = 0;
+		for (int y = 0; y < h; ++y) {
+			const uint16_t * row = depth.ptr<uint16_t>(y);
+			const uint16_t * up = y > 0 ? depth.ptr<uint16_t>(y - 1) : nullptr;
+			int x = 0;
+			while (x < w) {
+				int v = row[x];
+				if (v == 0) {
+					int end = x + 1;
+					while (end < w && row[end] == 0) end++;
+					bits.symbol(0, vals.k());
+					vals.update(0);
+					uint32_t run = end - x - 1;
+					bits.symbol(run, runs.k());
+					runs.update(run);
+					x = end;
+					continue;
+				}
+				int r = v - predict(row, up, x, last);
+				uint32_t s = (((uint32_t)r << 1) ^ (uint32_t)(r >> 31)) + 1;
+				bits.symbol(s, vals.k());
+				vals.update(s);
+				last = v;
+				x++;
+			}
+		}
+		return bits.finish() - dst;
+	}
+
+	// worst case every pixel takes an escape: LIMIT + 1 + RAW_BITS bits,
+	// plus the 8 bytes bit_writer writes ahead
+	static size_t maxSize(int w, int h) {
+		return KVD_HEADER + ((size_t)w * h * (LIMIT + 1 + RAW_BITS) + 7) / 8 + 8;
+	}
+
+	// Decodes into depth (CV_16UC1, reallocated only on a size change).
+	// False on anything that isn't a complete, well formed stream, or one
+	// of another size than expected, if given; checked before allocating.
+	static bool decode(const uint8_t * data, size_t size, cv::Mat & depth, cv::Size expected = cv::Size()) {
+		int w, h;
+		if (!readHeader(data, size, w, h)) return false;
+		if (expected.area() && (w != expected.width || h != expected.height)) return false;
+		depth.create(h, w, CV_16UC1);
+
+		bit_reader bits(data + KVD_HEADER, data + size);
+		adaptive vals, runs;
+		int last = 0;
+		for (int y = 0; y < h; ++y) {
+			uint16_t * row = depth.ptr<uint16_t>(y);
+			const uint16_t * up = y > 0 ? depth.ptr<uint16_t>(y - 1) : nullptr;
+			int x = 0;
+			while (x < w) {
+				uint32_t s;
+				if (!bits.symbol(vals.k(), s)) return false;
+				vals.update(s);
+				if (s == 0) {
+					uint32_t run;
+					if (!bits.symbol(runs.k(), run)) return false;
+					runs.update(run);
+					if (run >= (uint32_t)(w - x)) return false;
+					std::memset(row + x, 0, (run + 1) * sizeof(uint16_t));
+					x += run + 1;
+					continue;
+				}
+				s -= 1;
+				int r = (int)(s >> 1) ^ -(int)(s & 1);
+				int v = predict(row, up, x, last) + r;
+				if (v <= 0 || v > 0xffff) return false;
+				row[x] = v;
+				last = v;
+				x++;
+			}
+		}
+		return !bits.overrun();
+	}
+
+	static bool decode(const std::vector<uint8_t> & data, cv::Mat & depth, cv::Size expected = cv::Size()) {
+		return !data.empty() && decode(&data[0], data.size(), depth, expected);
+	}
+
+	// Frame size from a stream header, at most KVD_MAX_PIXELS.
+	static bool readHeader(const uint8_t * data, size_t size, int & w, int & h) {
+		if (size < KVD_HEADER || std::memcmp(data, KVD_MAGIC, sizeof(KVD_MAGIC)) != 0) return false;
+		uint32_t dims[2];
+		std::memcpy(dims, data + 4, sizeof(dims));
+		if (dims[0] == 0 || dims[1] == 0 || (uint64_t)dims[0] * dims[1] > KVD_MAX_PIXELS) return false;
+		w = dims[0];
+		h = dims[1];
+		return true;
+	}
+
+private:
+	static const int LIMIT = 24;     // longest unary prefix, longer ones escape
+	static const int RAW_BITS = 18;  // escaped symbols, fits 2 * 65535 + 2
+
+	static void writeHeader(uint8_t * p, int w, int h) {
+		uint32_t dims[3] = { (uint32_t)w, (uint32_t)h, 0 };
+		std::memcpy(p, KVD_MAGIC, sizeof(KVD_MAGIC));
+		std::memcpy(p + 4, dims, sizeof(dims));
+	}
+
+	// up is null on the first row; row[x - 1] is already decoded
+	static int predict(const uint16_t * row, const uint16_t * up, int x, int last) {
+		int l = x > 0 ? row[x - 1] : 0;
+		int u = up ? up[x] : 0;
+		if (l && u) {
+			int ul = up[x - 1];
+			if (ul) {
+				int p = l + u - ul;
+				return p < 0 ? 0 : (p > 0xffff ? 0xffff : p);
+			}
+			return l;
+		}
+		return l ? l : (u ? u : last);
+	}
+
+	// Rice parameter from the running mean of the coded values, halved now
+	// and then so it follows the content across the frame.
+	struct adaptive {
+		adaptive() : sum(16), count(1) {}
+
+		// smallest k with count << k >= sum, at most 16
+		int k() const {
+			int k = __builtin_clz(count) - __builtin_clz(sum);
+			if (k < 0) return 0;
+			if ((count << k) < sum) k++;
+			return k < 16 ? k : 16;
+		}
+
+		void update(uint32_t v) {
+			sum += v;
+			if (++count == 64) {
+				sum = (sum + 1) >> 1;
+				count >>= 1;
+			}
+		}
+
+		uint32_t sum, count;
+	};
+
+	// Writes the whole accumulator after every put and moves on by the
+	// complete bytes in it, so there's no branch on a full word.
+	class bit_writer {
+	public:
+		explicit bit_writer(uint8_t * p) : p(p), acc(0), n(0) {}
+
+		// len <= 56, v < 2^len; 8 bytes past the end have to be writable
+		void put(uint64_t v, int len) {
+			acc |= v << n;
+			n += len;
+			std::memcpy(p, &acc, 8);
+			p += n >> 3;
+			acc >>= n & ~7;
+			n &= 7;
+		}
+
+		// q zeros and a one, then the k low bits
+		void symbol(uint32_t s, int k) {
+			uint32_t q = s >> k;
+			if (q < (uint32_t)LIMIT) {
+				put((1ull << q) | (uint64_t)(s & ((1u << k) - 1)) << (q + 1), q + 1 + k);
+			} else {
+				put((1ull << LIMIT) | (uint64_t)s << (LIMIT + 1), LIMIT + 1 + RAW_BITS);
+			}
+		}
+
+		// end of the stream, the last partial byte is already written
+		uint8_t * finish() const {
+			return p + (n + 7) / 8;
+		}
+
+	private:
+		uint8_t * p;
+		uint64_t acc;
+		int n;
+	};
+
+	// Refills with one unaligned 8-byte load, leaving at least 56 bits,
+	// enough for any symbol; only the last bytes go one at a time.
+	class bit_reader {
+	public:
+		bit_reader(const uint8_t * p, const uint8_t * end) : p(p), end(end), acc(0), n(0), past_end(0) {}
+
+		bool symbol(int k, uint32_t & s) {
+			refill();
+			uint64_t prefix = acc & ((2ull << LIMIT) - 1);
+			if (prefix == 0) return false;
+			int q = __builtin_ctzll(prefix);
+			take(q + 1);
+			s = q < LIMIT ? ((uint32_t)q << k) | take(k) : take(RAW_BITS);
+			return true;
+		}
+
+		// read into the zeros after the end
+		bool overrun() const { return past_end > n; }
+
+	private:
+		void refill() {
+			if (end - p >= 8) {
+				uint64_t word;
+				std::memcpy(&word, p, 8);
+				acc |= word << n;
+				p += (63 - n) >> 3;
+				n |= 56;
+				return;
+			}
+			while (n <= 56) {
+				uint64_t byte = 0;
+				if (p < end) byte = *p++;
+				else past_end += 8;
+				acc |= byte << n;
+				n += 8;
+			}
+		}
+
+		uint32_t take(int len) {
+			uint32_t v = (uint32_t)(acc & ((1ull << len) - 1));
+			acc >>= len;
+			n -= len;
+			return v;
+		}
+
+		const uint8_t * p;
+		const uint8_t * end;
+		uint64_t acc;
+		int n;
+		int past_end;  // zero bits appended past the end
+	};
+};
+
+// .kvd file holding one encoded frame.
+inline bool writeDepthFile(const std::string & path, const cv::Mat & depth) {
+	std::vector<uint8_t> buf;
+	depth_codec::encode(depth, buf);
+	FILE * f = std::fopen(path.c_str(), "wb");
+	if (!f) return false;
+	bool ok = std::fwrite(&buf[0], buf.size(), 1, f) == 1;
+	return std::fclose(f) == 0 && ok;
+}
+
+inline bool readDepthFile(const std::string & path, cv::Mat & depth) {
+	FILE * f = std::fopen(path.c_str(), "rb");
+	if (!f) return false;
+	std::vector<uint8_t> buf;
+	uint8_t chunk[1 << 16];
+	size_t got;
+	while ((got = std::fread(chunk, 1, sizeof(chunk), f)) > 0) buf.insert(buf.end(), chunk, chunk + got);
+	std::fclose(f);
+	return depth_codec::decode(buf, depth);
+}
+
+#endif
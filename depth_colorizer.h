@@ -0,0 +1,59 @@
+#ifndef DEPTH_COLORIZER_H
+#define DEPTH_COLORIZER_H
+
+#include <opencv2/opencv.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// Maps 16-bit depth straight to BGR through a 65536-entry table.
+//
+// The table reproduces the old subtract/convertScaleAbs/applyColorMap(JET)
+// chain for the current min/range and has black for invalid (0) depth, so a
+// frame is colorized in a single sweep without temporaries.
+class depth_colorizer {
+public:
+	depth_colorizer() : lut(65536), depth_min(-1), depth_range(-1) {
+		cv::Mat ramp(1, 256, CV_8UC1);
+		for (int i = 0; i < 256; ++i) ramp.at<uchar>(0, i) = i;
+		cv::applyColorMap(ramp, jet, cv::COLORMAP_JET);
+	}
+
+	// Rebuilds the table if the range changed, returns true when it did.
+	bool update(int min, int range) {
+		if (min == depth_min && range == depth_range) return false;
+		depth_min = min;
+		depth_range = range;
+
+		double scale = 255. / std::max(range, 1);
+		lut[0] = cv::Vec3b(0, 0, 0);
+		for (int d = 1; d < 65536; ++d) {
+			int v = std::max(d - min, 0);
+			lut[d] = jet.at<cv::Vec3b>(0, cv::saturate_cast<uchar>(v * scale));
+		}
+		return true;
+	}
+
+	const cv::Vec3b & color(uint16_t d) const { return lut[d]; }
+
+	void apply(const cv::Mat & depth, cv::Mat & out) const {
+		out.create(depth.size(), CV_8UC3);
+		for (int y = 0; y < depth.rows; ++y) {
+			const uint16_t * src = depth.ptr<uint16_t>(y);
+			cv::Vec3b * dst = out.ptr<cv::Vec3b>(y);
+			for (int x = 0; x < depth.cols; ++x) {
+				dst[x] = lut[src[x]];
+			}
+		}
+	}
+
+	int min() const { return depth_min; }
+	int range() const { return depth_range; }
+
+private:
+	std::vector<cv::Vec3b> lut;
+	cv::Mat jet;
+	int depth_min, depth_range;
+};
+
+#endif
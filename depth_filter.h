@@ -0,0 +1,223 @@
+#ifndef DEPTH_FILTER_H
+#define DEPTH_FILTER_H
+
+#include <opencv2/opencv.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Temporal depth filter, run before colorization.
+//
+// Per-pixel state is kept as planes (structure of arrays) so every pass
+// streams through a few contiguous uint16/uint8 arrays:
+//
+// EMA     running mean plus the number of frames the pixel has been invalid.
+//         Invalid (0) samples don't pull the mean, the last value is held for
+//         up to hold frames before the pixel goes invalid as well.
+// MEDIAN  the last MEDIAN_TAPS samples, one plane each, and the output is the
+//         median of the valid ones.
+//
+// Both reject jumps: a sample more than jump mm away from the filter state
+// restarts the pixel instead of being smoothed into it, so moving edges don't
+// smear. Depth is assumed to stay below 32768 mm (Kinect tops out near 10 m).
+class depth_filter {
+public:
+	enum mode { OFF, EMA, MEDIAN, MODE_COUNT };
+
+	static const int MEDIAN_TAPS = 5;
+
+	depth_filter() : mode(OFF), alpha(0.3), jump(100), hold(5), last_mode(OFF), next_tap(0), primed(false) {}
+
+	static const char * name(int m) {
+		static const char * names[MODE_COUNT] = { "off", "ema", "median" };
+		return names[m];
+	}
+
+	// Filters depth into out, which has to be the same Mat on every call.
+	// With fresh == false the frame was seen before and out is left as is.
+	void apply(const cv::Mat & depth, cv::Mat & out, bool fresh = true) {
+		CV_Assert(depth.type() == CV_16UC1 && depth.isContinuous());
+		if (mode == OFF) {
+			depth.copyTo(out);
+			return;
+		}
+		if (depth.size() != size || mode != last_mode) reset(depth.size());
+		if (!fresh && primed) return;
+		out.create(size, CV_16UC1);
+
+		const uint16_t * d = depth.ptr<uint16_t>();
+		uint16_t * o = out.ptr<uint16_t>();
+		size_t n = depth.total();
+		if (mode == EMA) {
+			int w = std::min(std::max((int)(alpha * 256 + 0.5), 1), 256);
+			emaRun(d, &mean[0], &age[0], o, n, w, std::min(jump, 30000), hold);
+		} else {
+			uint16_t * taps[MEDIAN_TAPS];
+			for (int i = 0; i < MEDIAN_TAPS; ++i) taps[i] = &history[i * n];
+			std::copy(d, d + n, taps[next_tap]);
+			next_tap = (next_tap + 1) % MEDIAN_TAPS;
+			medianRun(d, taps, o, n, std::min(jump, 30000));
+		}
+		primed = true;
+	}
+
+	int mode;
+	double alpha;  // EMA weight of the new sample
+	int jump;      // mm
+	int hold;      // frames an invalid pixel keeps its EMA value
+
+private:
+	void reset(cv::Size s) {
+		size = s;
+		last_mode = mode;
+		size_t n = s.area();
+		mean.assign(mode == EMA ? n : 0, 0);
+		age.assign(mode == EMA ? n : 0, 255);
+		history.assign(mode == MEDIAN ? n * MEDIAN_TAPS : 0, 0);
+		next_tap = 0;
+		primed = false;
+	}
+
+	static void emaRun(const uint16_t * depth, uint16_t * mean, uint8_t * age, uint16_t * out,
+			size_t n, int w, int jump, int hold) {
+		size_t i = 0;
+#ifdef __SSE2__
+		__m128i zero = _mm_setzero_si128();
+		__m128i vjump = _mm_set1_epi16(jump);
+		__m128i vhold = _mm_set1_epi16(hold);
+		__m128i one = _mm_set1_epi16(1);
+		// madd of (diff, 1) pairs with (w, 128): diff * w + 128
+		__m128i wr = _mm_set1_epi32(w | (128 << 16));
+		for (; i + 8 <= n; i += 8) {
+			__m128i d = _mm_loadu_si128((const __m128i *)(depth + i));
+			__m128i m = _mm_loadu_si128((const __m128i *)(mean + i));
+			__m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(age + i)), zero);
+
+			__m128i valid = _mm_andnot_si128(_mm_cmpeq_epi16(d, zero), _mm_set1_epi16(-1));
+			__m128i held = _mm_andnot_si128(_mm_cmpeq_epi16(m, zero), _mm_set1_epi16(-1));
+			__m128i dist = _mm_or_si128(_mm_subs_epu16(d, m), _mm_subs_epu16(m, d));
+			__m128i far = _mm_andnot_si128(_mm_cmpeq_epi16(_mm_subs_epu16(dist, vjump), zero), _mm_set1_epi16(-1));
+			__m128i restart = _mm_and_si128(valid, _mm_or_si128(far, _mm_xor_si128(held, _mm_set1_epi16(-1))));
+
+			__m128i diff = _mm_sub_epi16(d, m);
+			__m128i lo = _mm_srai_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(diff, one), wr), 8);
+			__m128i hi = _mm_srai_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(diff, one), wr), 8);
+			__m128i ema = _mm_add_epi16(m, _mm_packs_epi32(lo, hi));
+
+			// invalid: keep m while age < hold, then drop to 0
+			__m128i keep = _mm_cmplt_epi16(a, vhold);
+			__m128i r = _mm_and_si128(m, keep);
+			r = _mm_or_si128(_mm_and_si128(valid, ema), _mm_andnot_si128(valid, r));
+			r = _mm_or_si128(_mm_and_si128(restart, d), _mm_andnot_si128(restart, r));
+
+			// age: 0 on valid samples, +1 (saturating at 255) otherwise
+			a = _mm_andnot_si128(valid, _mm_min_epi16(_mm_add_epi16(a, one), _mm_set1_epi16(255)));
+
+			_mm_storeu_si128((__m128i *)(mean + i), r);
+			_mm_storeu_si128((__m128i *)(out + i), r);
+			_mm_storel_epi64((__m128i *)(age + i), _mm_packus_epi16(a, zero));
+		}
+#endif
+		for (; i < n; ++i) {
+			int d = depth[i], m = mean[i];
+			int r;
+			if (d != 0) {
+				int dist = d > m ? d - m : m - d;
+				if (m == 0 || dist > jump) r = d;
+				else r = m + (((d - m) * w + 128) >> 8);
+				age[i] = 0;
+			} else {
+				r = age[i] < hold ? m : 0;
+				age[i] = std::min(age[i] + 1, 255);
+			}
+			mean[i] = r;
+			out[i] = r;
+		}
+	}
+
+	static void medianRun(const uint16_t * depth, uint16_t * const * taps, uint16_t * out,
+			size_t n, int jump) {
+		size_t i = 0;
+#ifdef __SSE2__
+		__m128i zero = _mm_setzero_si128();
+		__m128i big = _mm_set1_epi16(0x7fff);
+		__m128i vjump = _mm_set1_epi16(jump);
+		for (; i + 8 <= n; i += 8) {
+			__m128i d = _mm_loadu_si128((const __m128i *)(depth + i));
+			__m128i d_valid = _mm_andnot_si128(_mm_cmpeq_epi16(d, zero), _mm_set1_epi16(-1));
+
+			// invalid or (when d is valid) too far from d: moved to the top
+			// as 0x7fff so they sort past every real sample
+			__m128i v[MEDIAN_TAPS];
+			__m128i count = zero;
+			for (int t = 0; t < MEDIAN_TAPS; ++t) {
+				__m128i s = _mm_loadu_si128((const __m128i *)(taps[t] + i));
+				__m128i dist = _mm_or_si128(_mm_subs_epu16(s, d), _mm_subs_epu16(d, s));
+				__m128i far = _mm_and_si128(d_valid,
+					_mm_andnot_si128(_mm_cmpeq_epi16(_mm_subs_epu16(dist, vjump), zero), _mm_set1_epi16(-1)));
+				__m128i bad = _mm_or_si128(_mm_cmpeq_epi16(s, zero), far);
+				v[t] = _mm_or_si128(_mm_andnot_si128(bad, s), _mm_and_si128(bad, big));
+				count = _mm_sub_epi16(count, _mm_xor_si128(bad, _mm_set1_epi16(-1)));
+			}
+
+			sort2(v[0], v[1]); sort2(v[3], v[4]); sort2(v[2], v[4]);
+			sort2(v[2], v[3]); sort2(v[0], v[3]); sort2(v[0], v[2]);
+			sort2(v[1], v[4]); sort2(v[1], v[3]); sort2(v[1], v[2]);
+
+			// median of the count valid samples: index (count - 1) / 2
+			__m128i r = v[0];
+			__m128i ge3 = _mm_cmpgt_epi16(count, _mm_set1_epi16(2));
+			r = _mm_or_si128(_mm_and_si128(ge3, v[1]), _mm_andnot_si128(ge3, r));
+			__m128i is5 = _mm_cmpeq_epi16(count, _mm_set1_epi16(5));
+			r = _mm_or_si128(_mm_and_si128(is5, v[2]), _mm_andnot_si128(is5, r));
+			r = _mm_andnot_si128(_mm_cmpeq_epi16(count, zero), r);
+			_mm_storeu_si128((__m128i *)(out + i), r);
+		}
+#endif
+		for (; i < n; ++i) {
+			int d = depth[i];
+			uint16_t v[MEDIAN_TAPS];
+			int count = 0;
+			for (int t = 0; t < MEDIAN_TAPS; ++t) {
+				int s = taps[t][i];
+				int dist = s > d ? s - d : d - s;
+				if (s != 0 && (d == 0 || dist <= jump)) v[count++] = s;
+			}
+			if (count == 0) {
+				out[i] = 0;
+				continue;
+			}
+			std::sort(v, v + count);
+			out[i] = v[(count - 1) / 2];
+		}
+	}
+
+#ifdef __SSE2__
+	static void sort2(__m128i & a, __m128i & b) {
+		__m128i t = _mm_min_epi16(a, b);
+		b = _mm_max_epi16(a, b);
+		a = t;
+	}
+#endif
+
+	cv::Size size;
+	int last_mode;
+
+	// EMA state
+	std::vector<uint16_t> mean;
+	std::vector<uint8_t> age;
+
+	// MEDIAN state, MEDIAN_TAPS planes back to back
+	std::vector<uint16_t> history;
+	int next_tap;
+
+	// out holds the result for the current state
+	bool primed;
+};
+
+#endif
@@ -0,0 +1,134 @@
+#ifndef DEPTH_HIST_H
+#define DEPTH_HIST_H
+
+#include <opencv2/opencv.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Integer histogram of CV_16UC1 depth with a cumulative/percentile query API.
+//
+// Bin i holds depths [i*bin_width, (i+1)*bin_width), invalid (0) and out of
+// range samples are not counted. The frame is split into row bands, each band
+// fills its own partial histogram (four interleaved copies, so consecutive
+// pixels falling into the same bin don't serialize on one counter) and the
+// partials are merged at the end. Percentiles are a binary search over the
+// cumulative counts built during the merge.
+class depth_hist {
+public:
+	depth_hist(int bins = 1000, int bin_width = 5, int bands = 8) :
+		nbins(bins), width(bin_width), nbands(bands),
+		counts(bins), cum(bins), sum(0),
+		partials(bands * LANES * (bins + 1))
+	{
+		// d / width as a multiply-shift, exact for any 16-bit d
+		mul = (uint64_t(1) << 32) / width + 1;
+	}
+
+	void compute(const cv::Mat & depth, bool parallel = true) {
+		CV_Assert(depth.type() == CV_16UC1);
+		std::fill(partials.begin(), partials.end(), 0);
+
+		band_body body(*this, depth);
+		if (parallel) {
+			cv::parallel_for_(cv::Range(0, nbands), body);
+		} else {
+			body(cv::Range(0, nbands));
+		}
+
+		size_t stride = nbins + 1;
+		uint64_t acc = 0;
+		for (int i = 0; i < nbins; ++i) {
+			uint32_t c = 0;
+			for (int p = 0; p < nbands * LANES; ++p) {
+				c += partials[p * stride + i];
+			}
+			counts[i] = c;
+			acc += c;
+			cum[i] = acc;
+		}
+		sum = acc;
+	}
+
+	int bins() const { return nbins; }
+	int binWidth() const { return width; }
+
+	uint32_t count(int bin) const { return counts[bin]; }
+	uint64_t cumulative(int bin) const { return cum[bin]; }
+	uint64_t total() const { return sum; }
+
+	uint32_t maxCount() const {
+		return *std::max_element(counts.begin(), counts.end());
+	}
+
+	uint32_t minCount() const {
+		return *std::min_element(counts.begin(), counts.end());
+	}
+
+	// Depth (lower edge of the bin) below which fraction p of valid samples lie.
+	int percentile(double p) const {
+		if (sum == 0) return 0;
+		uint64_t target = std::max<uint64_t>(1, uint64_t(p * sum));
+		int bin = std::lower_bound(cum.begin(), cum.end(), target) - cum.begin();
+		return std::min(bin, nbins - 1) * width;
+	}
+
+private:
+	static const int LANES = 4;
+
+	class band_body : public cv::ParallelLoopBody {
+	public:
+		band_body(depth_hist & hist, const cv::Mat & depth) : hist(hist), depth(depth) {}
+
+		void operator()(const cv::Range & range) const {
+			for (int b = range.start; b < range.end; ++b) {
+				int y0 = depth.rows * b / hist.nbands;
+				int y1 = depth.rows * (b + 1) / hist.nbands;
+				hist.fillBand(depth, y0, y1, &hist.partials[b * LANES * (hist.nbins + 1)]);
+			}
+		}
+
+	private:
+		depth_hist & hist;
+		const cv::Mat & depth;
+	};
+
+	inline uint32_t binOf(uint16_t d) const {
+		uint32_t b = (d * mul) >> 32;
+		// zero and out of range go to the spill bin at the end
+		return (d == 0 || b >= (uint32_t)nbins) ? nbins : b;
+	}
+
+	void fillBand(const cv::Mat & depth, int y0, int y1, uint32_t * out) const {
+		size_t stride = nbins + 1;
+		uint32_t * h0 = out;
+		uint32_t * h1 = out + stride;
+		uint32_t * h2 = out + stride * 2;
+		uint32_t * h3 = out + stride * 3;
+		for (int y = y0; y < y1; ++y) {
+			const uint16_t * src = depth.ptr<uint16_t>(y);
+			int x = 0;
+			for (; x + 4 <= depth.cols; x += 4) {
+				h0[binOf(src[x])]++;
+				h1[binOf(src[x+1])]++;
+				h2[binOf(src[x+2])]++;
+				h3[binOf(src[x+3])]++;
+			}
+			for (; x < depth.cols; ++x) {
+				h0[binOf(src[x])]++;
+			}
+		}
+	}
+
+	int nbins, width, nbands;
+	uint64_t mul;
+
+	std::vector<uint32_t> counts;
+	std::vector<uint64_t> cum;
+	uint64_t sum;
+
+	std::vector<uint32_t> partials;
+};
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <opencv2/opencv.hpp>
+
+#include <chrono>
+#include <cstdint>
+
+// Device timestamps count a 60 MHz clock.
+static const double FRAME_TICKS_PER_MS = 60000;
+
+// RGB+depth pair as published by the acquisition thread.
+struct frame {
+	frame() : rgb_ts(0), depth_ts(0), skewed(false), seq(0), grab_ms(0), convert_ms(0) {}
+
+	// RGB capture time minus depth capture time
+	float skewMs() const {
+		return (int32_t)(rgb_ts - depth_ts) / FRAME_TICKS_PER_MS;
+	}
+
+	cv::Mat rgb;        // CV_8UC3, BGR
+	cv::Mat depth;      // CV_16UC1, millimetres, 0 = invalid
+	uint32_t rgb_ts;    // device timestamps of the two images
+	uint32_t depth_ts;
+	bool skewed;        // paired although further apart than the limit
+	uint64_t seq;       // acquisition counter, gaps mean dropped frames
+	std::chrono::system_clock::time_point time;
+
+	// acquisition thread timing, reported by the frame loop
+	float grab_ms;     // whole grab, including waiting for the device
+	float convert_ms;  // format conversion within the grab
+};
+
+#endif
@@ -0,0 +1,180 @@
+#ifndef FRAME_PAIRING_H
+#define FRAME_PAIRING_H
+
+#include <opencv2/opencv.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <vector>
+
+#include "frame.h"
+
+// Skew of the pairs frame_pairing handed out (or dropped), over the last
+// window pairs and since the start.
+class skew_stats {
+public:
+	struct summary {
+		summary() : last(0), mean(0), max(0), pairs(0), over(0), dropped(0) {}
+		float last, mean, max;  // ms, absolute skew over the window
+		uint64_t pairs;         // totals
+		uint64_t over;          // pairs over the limit, dropped or flagged
+		uint64_t dropped;
+	};
+
+	explicit skew_stats(size_t window = 64) : recent(window, 0), next(0) {}
+
+	void add(float skew_ms, bool over, bool dropped) {
+		std::lock_guard<std::mutex> lock(mtx);
+		recent[next++ % recent.size()] = std::fabs(skew_ms);
+		totals.last = skew_ms;
+		totals.pairs++;
+		totals.over += over;
+		totals.dropped += dropped;
+	}
+
+	summary get() const {
+		std::lock_guard<std::mutex> lock(mtx);
+		summary s = totals;
+		size_t n = std::min<size_t>(next, recent.size());
+		for (size_t i = 0; i < n; ++i) {
+			s.mean += recent[i];
+			s.max = std::max(s.max, recent[i]);
+		}
+		if (n) s.mean /= n;
+		return s;
+	}
+
+private:
+	mutable std::mutex mtx;
+	std::vector<float> recent;
+	size_t next;
+	summary totals;
+};
+
+// Pairs RGB and depth images that arrive as separate streams.
+//
+// Each stream goes into a short queue of timestamped images, match() takes
+// the RGB/depth pair closest in time and drops whatever queued before it.
+// When that pair is over max_skew_ms and the lagging stream may still
+// deliver a closer image, match() waits for it rather than pairing the
+// newer image with the previous frame of the other stream. Pairs that stay
+// over the limit are dropped, or handed out with frame::skewed set.
+//
+// Images are swapped in and out of the queues, the buffers circulate between
+// them and the frames without being copied or reallocated.
+class frame_pairing {
+public:
+	explicit frame_pairing(size_t depth = 3) :
+		max_skew_ms(10), drop_skewed(false), rgbs(depth), depths(depth) {}
+
+	// Buffer for the next image of a stream, stamped ts. The oldest queued
+	// image is given up when the queue is full.
+	cv::Mat & rgbSlot(uint32_t ts) { return rgbs.push(ts); }
+	cv::Mat & depthSlot(uint32_t ts) { return depths.push(ts); }
+
+	// Moves the closest pair into f. False when there's no pair yet, the
+	// pair waits for a closer partner or it was dropped for its skew.
+	bool match(frame & f) {
+		if (rgbs.empty() || depths.empty()) return false;
+
+		// ties go to the newer pair
+		size_t best_r = 0, best_d = 0;
+		uint32_t best = UINT32_MAX;
+		for (size_t r = 0; r < rgbs.size(); ++r) {
+			for (size_t d = 0; d < depths.size(); ++d) {
+				uint32_t dist = std::abs((int64_t)(int32_t)(rgbs.ts(r) - depths.ts(d)));
+				if (dist <= best) {
+					best = dist;
+					best_r = r;
+					best_d = d;
+				}
+			}
+		}
+
+		int32_t diff = rgbs.ts(best_r) - depths.ts(best_d);
+		float skew = diff / FRAME_TICKS_PER_MS;
+		bool over = std::fabs(skew) > max_skew_ms;
+
+		// the lagging stream's next image, about a period later, is the
+		// closer partner when this one is over half a period away
+		bool rgb_lags = diff < 0;
+		const stream & lagging = rgb_lags ? rgbs : depths;
+		bool newest = (rgb_lags ? best_r : best_d) + 1 == lagging.size();
+		if (over && newest && best > lagging.period() / 2 && !lagging.full()) return false;
+
+		bool drop = over && drop_skewed;
+		stats.add(skew, over, drop);
+		f.rgb_ts = rgbs.ts(best_r);
+		f.depth_ts = depths.ts(best_d);
+
+		rgbs.drop(best_r);
+		depths.drop(best_d);
+		if (drop) {
+			rgbs.pop();
+			depths.pop();
+			return false;
+		}
+		cv::swap(f.rgb, rgbs.front());
+		cv::swap(f.depth, depths.front());
+		rgbs.pop();
+		depths.pop();
+		f.skewed = over;
+		return true;
+	}
+
+	// set from the UI thread
+	std::atomic<double> max_skew_ms;
+	std::atomic<bool> drop_skewed;
+
+	skew_stats stats;
+
+private:
+	// Fixed ring of timestamped images, index 0 is the oldest.
+	class stream {
+	public:
+		explicit stream(size_t capacity) :
+			images(capacity), stamps(capacity), head(0), count(0), last_ts(0), last_period(0) {}
+
+		bool empty() const { return count == 0; }
+		size_t size() const { return count; }
+		bool full() const { return count == images.size(); }
+		uint32_t ts(size_t i) const { return stamps[(head + i) % stamps.size()]; }
+		cv::Mat & front() { return images[head]; }
+
+		// ticks between the last two images pushed
+		uint32_t period() const { return last_period; }
+
+		cv::Mat & push(uint32_t ts) {
+			if (count == images.size()) pop();
+			size_t i = (head + count++) % images.size();
+			stamps[i] = ts;
+			last_period = ts - last_ts;
+			last_ts = ts;
+			return images[i];
+		}
+
+		void pop() {
+			head = (head + 1) % images.size();
+			count--;
+		}
+
+		// the n oldest
+		void drop(size_t n) {
+			while (n--) pop();
+		}
+
+	private:
+		std::vector<cv::Mat> images;
+		std::vector<uint32_t> stamps;
+		size_t head, count;
+		uint32_t last_ts, last_period;
+	};
+
+	stream rgbs, depths;
+};
+
+#endif
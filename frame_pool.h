@@ -0,0 +1,115 @@
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "frame.h"
+
+class frame_pool;
+
+// Shared handle to a pooled frame. Copies refer to the same frame; the slot
+// goes back to its pool when the last handle lets go. Holders treat the
+// frame as read-only, so any number of consumers (display, recorder, savers)
+// can keep the same RGB+depth pair without copying it.
+class frame_ref {
+public:
+	frame_ref() : pool(nullptr), id(0) {}
+	frame_ref(const frame_ref & other);
+	frame_ref(frame_ref && other) : pool(other.pool), id(other.id) { other.pool = nullptr; }
+	~frame_ref() { reset(); }
+
+	frame_ref & operator=(frame_ref other) {
+		std::swap(pool, other.pool);
+		std::swap(id, other.id);
+		return *this;
+	}
+
+	void reset();
+
+	explicit operator bool() const { return pool != nullptr; }
+	frame & operator*() const;
+	frame * operator->() const { return &**this; }
+
+private:
+	friend class frame_pool;
+	frame_ref(frame_pool * pool, uint32_t id) : pool(pool), id(id) {}
+
+	frame_pool * pool;
+	uint32_t id;
+};
+
+// Fixed number of frame slots. Image buffers are allocated the first time a
+// slot is filled and reused from then on. The pool must outlive every
+// frame_ref it hands out.
+class frame_pool {
+public:
+	explicit frame_pool(size_t count = 48) : slots(count), starved_cnt(0) {
+		free_ids.reserve(count);
+		for (size_t i = count; i-- > 0; ) free_ids.push_back(i);
+	}
+
+	// Empty ref when every slot is held.
+	frame_ref acquire() {
+		std::lock_guard<std::mutex> lock(mtx);
+		if (free_ids.empty()) {
+			starved_cnt++;
+			return frame_ref();
+		}
+		uint32_t id = free_ids.back();
+		free_ids.pop_back();
+		slots[id].refs.store(1, std::memory_order_relaxed);
+		return frame_ref(this, id);
+	}
+
+	size_t size() const { return slots.size(); }
+
+	size_t available() {
+		std::lock_guard<std::mutex> lock(mtx);
+		return free_ids.size();
+	}
+
+	// acquire() calls that found no free slot
+	uint64_t starved() const { return starved_cnt; }
+
+private:
+	friend class frame_ref;
+
+	struct slot {
+		slot() : refs(0) {}
+		frame f;
+		std::atomic<int> refs;
+	};
+
+	void addRef(uint32_t id) {
+		slots[id].refs.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void release(uint32_t id) {
+		if (slots[id].refs.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+		std::lock_guard<std::mutex> lock(mtx);
+		free_ids.push_back(id);
+	}
+
+	std::vector<slot> slots;
+	std::vector<uint32_t> free_ids;
+	std::mutex mtx;
+	std::atomic<uint64_t> starved_cnt;
+};
+
+inline frame_ref::frame_ref(const frame_ref & other) : pool(other.pool), id(other.id) {
+	if (pool) pool->addRef(id);
+}
+
+inline void frame_ref::reset() {
+	if (pool) pool->release(id);
+	pool = nullptr;
+}
+
+inline frame & frame_ref::operator*() const {
+	return pool->slots[id].f;
+}
+
+#endif
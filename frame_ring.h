@@ -0,0 +1,135 @@
+#ifndef FRAME_RING_H
+#define FRAME_RING_H
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+// Bounded single-producer/single-consumer ring that never blocks the producer.
+//
+// Items are preallocated: the producer fills back() in place and publishes it
+// with push(), the consumer takes the oldest published item with pop() and
+// hands it back with release(). When the ring is full push() recycles the
+// oldest unread item and counts it as dropped, so a slow consumer only loses
+// frames and never stalls acquisition.
+//
+// The consumer is expected to hold at most one item at a time.
+template<typename T>
+class frame_ring {
+public:
+	explicit frame_ring(size_t capacity = 3) :
+		items(capacity + 2),
+		ready(capacity),
+		free_ids(capacity + 2),
+		ready_head(0), ready_tail(0),
+		free_head(0), free_tail(0),
+		writing(0),
+		pushed_cnt(0), dropped_cnt(0)
+	{
+		// item 0 is the producer's, the rest start out free
+		for (uint32_t i = 1; i < items.size(); ++i) {
+			free_ids[free_head % free_ids.size()].store(i, std::memory_order_relaxed);
+			free_head++;
+		}
+	}
+
+	size_t capacity() const { return ready.size(); }
+
+	// producer side
+
+	T & back() { return items[writing]; }
+
+	// push() would drop the oldest unread item
+	bool full() const {
+		return ready_head.load(std::memory_order_relaxed) - ready_tail.load(std::memory_order_acquire) >= ready.size();
+	}
+
+	void push() {
+		uint64_t h = ready_head.load(std::memory_order_relaxed);
+		uint64_t t = ready_tail.load(std::memory_order_acquire);
+		uint32_t recycled = NONE;
+		while (h - t >= ready.size()) {
+			if (ready_tail.compare_exchange_weak(t, t + 1, std::memory_order_acq_rel)) {
+				recycled = ready[t % ready.size()].load(std::memory_order_relaxed);
+				dropped_cnt.fetch_add(1, std::memory_order_relaxed);
+				break;
+			}
+		}
+
+		ready[h % ready.size()].store(writing, std::memory_order_relaxed);
+		ready_head.store(h + 1, std::memory_order_release);
+		pushed_cnt.fetch_add(1, std::memory_order_relaxed);
+
+		writing = (recycled != NONE) ? recycled : acquireFree();
+	}
+
+	// consumer side
+
+	T * pop() {
+		uint64_t t = ready_tail.load(std::memory_order_acquire);
+		for (;;) {
+			if (t == ready_head.load(std::memory_order_acquire))
+				return nullptr;
+			uint32_t id = ready[t % ready.size()].load(std::memory_order_relaxed);
+			if (ready_tail.compare_exchange_weak(t, t + 1, std::memory_order_acq_rel))
+				return &items[id];
+		}
+	}
+
+	void release(T * item) {
+		uint32_t id = item - &items[0];
+		uint64_t h = free_head.load(std::memory_order_relaxed);
+		free_ids[h % free_ids.size()].store(id, std::memory_order_relaxed);
+		free_head.store(h + 1, std::memory_order_release);
+	}
+
+	// statistics, safe to read from any thread
+
+	uint64_t pushed() const { return pushed_cnt.load(std::memory_order_relaxed); }
+	uint64_t dropped() const { return dropped_cnt.load(std::memory_order_relaxed); }
+
+private:
+	static const uint32_t NONE = 0xffffffff;
+
+	uint32_t acquireFree() {
+		for (;;) {
+			uint64_t t = free_tail.load(std::memory_order_relaxed);
+			if (t != free_head.load(std::memory_order_acquire)) {
+				uint32_t id = free_ids[t % free_ids.size()].load(std::memory_order_relaxed);
+				free_tail.store(t + 1, std::memory_order_release);
+				return id;
+			}
+
+			// consumer is sitting on more than one item, steal the oldest unread one
+			uint64_t rt = ready_tail.load(std::memory_order_acquire);
+			if (rt != ready_head.load(std::memory_order_relaxed)) {
+				uint32_t id = ready[rt % ready.size()].load(std::memory_order_relaxed);
+				if (ready_tail.compare_exchange_weak(rt, rt + 1, std::memory_order_acq_rel)) {
+					dropped_cnt.fetch_add(1, std::memory_order_relaxed);
+					return id;
+				}
+				continue;
+			}
+
+			std::this_thread::yield();
+		}
+	}
+
+	std::vector<T> items;
+
+	std::vector< std::atomic<uint32_t> > ready;
+	std::vector< std::atomic<uint32_t> > free_ids;
+
+	std::atomic<uint64_t> ready_head;
+	std::atomic<uint64_t> ready_tail;
+	std::atomic<uint64_t> free_head;
+	std::atomic<uint64_t> free_tail;
+
+	uint32_t writing;
+
+	std::atomic<uint64_t> pushed_cnt;
+	std::atomic<uint64_t> dropped_cnt;
+};
+
+#endif
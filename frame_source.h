@@ -0,0 +1,154 @@
+#ifndef FRAME_SOURCE_H
+#define FRAME_SOURCE_H
+
+#include <libfreenect_sync.h>
+#include <opencv2/opencv.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+#include "frame.h"
+#include "frame_pairing.h"
+#include "ir_tone.h"
+
+// Where the acquisition thread pulls frames from.
+class frame_source {
+public:
+	enum result {
+		FAILED = -2, // source broke, acquisition stops
+		END = -1,    // nothing more to come
+		IDLE = 0,    // no frame this time, ask again
+		FRAME = 1
+	};
+
+	frame_source() : seq(0) {}
+	virtual ~frame_source() {}
+
+	// Fills f with the next frame, including timestamps, seq and time. May block for about
+	// a frame period, but has to return now and then so acquisition can stop.
+	virtual result grab(frame & f) = 0;
+
+	// Called on the acquisition thread after the last grab().
+	virtual void close() {}
+
+	// Unpaced sources (a recording played as fast as possible, say) want
+	// every frame processed: acquisition then waits for the consumer
+	// instead of letting the ring drop frames.
+	virtual bool lossless() const { return false; }
+
+protected:
+	// seq and wall clock for sources that don't carry their own
+	void stamp(frame & f) {
+		f.seq = seq++;
+		f.time = std::chrono::system_clock::now();
+	}
+
+private:
+	uint64_t seq;
+};
+
+// Live Kinect through the freenect sync wrapper. Video and depth are
+// separate streams, every grab() fetches one image of each and hands out the
+// best matching pair from frame_pairing.
+class freenect_source : public frame_source {
+public:
+	explicit freenect_source(int index) :
+		depth_aligned(true), video_ir(false), ir_curve(ir_tone::QUADRATIC), ir_gamma(2.2), index(index)
+	{
+		open_count()++;
+	}
+
+	result grab(frame & f) {
+		char *rgb = 0;
+		short *depth = 0;
+		uint32_t ts;
+		int ret;
+
+		if (video_ir) {
+			ret = freenect_sync_get_video((void**)&rgb, &ts, index, FREENECT_VIDEO_IR_10BIT);
+			if (ret < 0) return fail();
+			auto start = std::chrono::steady_clock::now();
+			cv::Mat tmp_ir(480, 640, CV_16UC1, rgb);
+			tone.select(ir_curve, ir_gamma);
+			tone.apply(tmp_ir, pairing.rgbSlot(ts));
+			f.convert_ms = elapsedMs(start);
+		} else {
+			ret = freenect_sync_get_video((void**)&rgb, &ts, index, FREENECT_VIDEO_RGB);
+			if (ret < 0) return fail();
+			auto start = std::chrono::steady_clock::now();
+			cv::Mat tmp_rgb(480, 640, CV_8UC3, rgb);
+			cv::cvtColor(tmp_rgb, pairing.rgbSlot(ts), cv::COLOR_RGB2BGR);
+			f.convert_ms = elapsedMs(start);
+		}
+
+		if (depth_aligned) {
+			ret = freenect_sync_get_depth((void**)&depth, &ts, index, FREENECT_DEPTH_REGISTERED);
+		} else {
+			ret = freenect_sync_get_depth((void**)&depth, &ts, index, FREENECT_DEPTH_MM);
+		}
+		if (ret < 0) return fail();
+		// freenect reuses its buffer, so the queue gets its own copy
+		cv::Mat tmp_depth(480, 640, CV_16UC1, depth);
+		tmp_depth.copyTo(pairing.depthSlot(ts));
+
+		if (!pairing.match(f)) return IDLE;
+		stamp(f);
+		return FRAME;
+	}
+
+	// freenect_sync_stop() stops every device, so only the last one to
+	// close calls it.
+	void close() {
+		if (--open_count() == 0) freenect_sync_stop();
+	}
+
+	// toggled from the UI thread, picked up on the next grab
+	std::atomic<bool> depth_aligned;
+	std::atomic<bool> video_ir;
+	std::atomic<int> ir_curve;
+	std::atomic<double> ir_gamma;
+
+	frame_pairing pairing;
+
+private:
+	static float elapsedMs(std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	static std::atomic<int> & open_count() {
+		static std::atomic<int> count(0);
+		return count;
+	}
+
+	result fail() {
+		std::cerr << "Can't grab frames from device " << index << std::endl;
+		return FAILED;
+	}
+
+	int index;
+	ir_tone tone;
+};
+
+// A still RGB+depth pair repeated at the sensor rate.
+class image_source : public frame_source {
+public:
+	image_source(const cv::Mat & rgb, const cv::Mat & depth, double fps = 30) :
+		rgb(rgb), depth(depth), period(1.0 / fps) {}
+
+	result grab(frame & f) {
+		std::this_thread::sleep_for(period);
+		rgb.copyTo(f.rgb);
+		depth.copyTo(f.depth);
+		f.rgb_ts = f.depth_ts = 0;
+		stamp(f);
+		return FRAME;
+	}
+
+private:
+	cv::Mat rgb, depth;
+	std::chrono::duration<double> period;
+};
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef FRAME_WORKSPACE_H
+#define FRAME_WORKSPACE_H
+
+#include <opencv2/opencv.hpp>
+
+// Working buffers of the frame loop. Everything is allocated by reserve()
+// for a given frame size and then reused, so the loop doesn't touch the heap
+// in steady state. A frame of a different size reallocates once.
+struct frame_workspace {
+	frame_workspace() : panel(640, 480) {}
+
+	// Returns true if buffers had to be (re)allocated.
+	bool reserve(cv::Size frame_size) {
+		if (frame_size == size) return false;
+		size = frame_size;
+
+		filtered_depth.create(size, CV_16UC1);
+		filled_depth.create(size, CV_16UC1);
+		col_depth.create(size, CV_8UC3);
+		out_rgb.create(size, CV_8UC3);
+
+		panel_rgb.create(panel, CV_8UC3);
+		panel_depth.create(panel, CV_8UC3);
+		return true;
+	}
+
+	cv::Size size;
+
+	// pipeline outputs, frame size
+	cv::Mat filtered_depth;  // temporal filter output, unused while it's off
+	cv::Mat filled_depth;    // hole filled, unused while it's off
+	cv::Mat col_depth;  // colorized depth
+	cv::Mat out_rgb;    // range-masked, blended RGB
+
+	// GUI panels, scaled copies of the above when the frame isn't panel sized
+	cv::Size panel;
+	cv::Mat panel_rgb;
+	cv::Mat panel_depth;
+
+	// GUI histogram plot, sized by drawHist on first use
+	cv::Mat hist_img;
+};
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef HISTORY_PLOT_H
+#define HISTORY_PLOT_H
+
+#include <opencv2/opencv.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "probe_history.h"
+
+// Scrolling plot of the probe traces.
+//
+// A column shows one block of samples as the span of its valid values, so
+// the ring can be far longer than the plot is wide. update() scrolls the
+// image one column per completed block and draws only the new column; the
+// whole plot is redrawn only when probes change or a trace leaves its
+// display range (or shrinks well inside it), which the rings' running
+// min/max tell without looking at the samples.
+class history_plot {
+public:
+	explicit history_plot(int width = 800, int height = 100) :
+		width(width), height(height), spc(0), drawn(0), version(0)
+	{
+	}
+
+	void update(const probe_history & probes) {
+		int per_column = std::max((probes.length() + width - 1) / width, 1);
+		uint64_t blocks = probes.count() / per_column;
+		bool redraw = img.empty() || per_column != spc || probes.version() != version ||
+			traces.size() != probes.size() || blocks < drawn;
+		spc = per_column;
+		version = probes.version();
+		traces.resize(probes.size());
+
+		if (rescale(probes) || redraw) {
+			redrawAll(probes, blocks);
+		} else {
+			for (; drawn < blocks; ++drawn) {
+				scroll();
+				drawColumn(probes, drawn, width - 1);
+			}
+		}
+		drawn = blocks;
+	}
+
+	const cv::Mat & image() const { return img; }
+
+private:
+	struct trace {
+		trace() : lo(0), hi(0), last_y(-1) {}
+		float lo, hi;  // display range, hi == lo when there's nothing to show
+		int last_y;    // row of the last valid sample drawn, -1 after a gap
+	};
+
+	// Updates display ranges that no longer fit, returns whether any did.
+	bool rescale(const probe_history & probes) {
+		bool changed = false;
+		for (size_t i = 0; i < probes.size(); ++i) {
+			const window_extrema & r = probes.range(i);
+			trace & t = traces[i];
+			if (r.empty()) {
+				changed |= t.hi != t.lo;
+				t.lo = t.hi = 0;
+				continue;
+			}
+			float span = std::max(r.max() - r.min(), 20);
+			float lo = r.min() - 0.05f * span, hi = r.max() + 0.05f * span;
+			if (t.hi == t.lo || r.min() < t.lo || r.max() > t.hi || t.hi - t.lo > 3 * (hi - lo)) {
+				t.lo = lo;
+				t.hi = hi;
+				changed = true;
+			}
+		}
+		return changed;
+	}
+
+	void redrawAll(const probe_history & probes, uint64_t blocks) {
+		img.create(height, width, CV_8UC3);
+		img.setTo(cv::Scalar::all(0));
+		for (size_t i = 0; i < traces.size(); ++i) traces[i].last_y = -1;
+		uint64_t first = blocks > (uint64_t)width ? blocks - width : 0;
+		for (uint64_t b = first; b < blocks; ++b) {
+			drawColumn(probes, b, width - (int)(blocks - b));
+		}
+	}
+
+	void scroll() {
+		size_t row_bytes = (width - 1) * 3;
+		for (int y = 0; y < height; ++y) {
+			uint8_t * row = img.ptr<uint8_t>(y);
+			std::memmove(row, row + 3, row_bytes);
+			std::memset(row + row_bytes, 0, 3);
+		}
+	}
+
+	int rowOf(const trace & t, int v) const {
+		int y = (int)((height - 1) * (1 - (v - t.lo) / (t.hi - t.lo)));
+		return std::min(std::max(y, 0), height - 1);
+	}
+
+	// block b of every trace into column x
+	void drawColumn(const probe_history & probes, uint64_t b, int x) {
+		for (size_t i = 0; i < probes.size(); ++i) {
+			trace & t = traces[i];
+			int vmin = 0, vmax = 0, vlast = 0;
+			for (uint64_t s = b * spc; s < (b + 1) * spc; ++s) {
+				int v = probes.at(i, s);
+				if (v == 0) continue;
+				if (vmin == 0 || v < vmin) vmin = v;
+				if (v > vmax) vmax = v;
+				vlast = v;
+			}
+			if (vmax == 0 || t.hi == t.lo) {
+				t.last_y = -1;
+				continue;
+			}
+
+			// span of the block, joined to the previous column's last sample
+			int y0 = rowOf(t, vmax), y1 = rowOf(t, vmin);
+			if (t.last_y >= 0) {
+				y0 = std::min(y0, t.last_y);
+				y1 = std::max(y1, t.last_y);
+			}
+			cv::Vec3b color = toVec3b(probes[i].color);
+			for (int y = y0; y <= y1; ++y) img.at<cv::Vec3b>(y, x) = color;
+			t.last_y = rowOf(t, vlast);
+		}
+	}
+
+	static cv::Vec3b toVec3b(const cv::Scalar & c) {
+		return cv::Vec3b((uint8_t)c[0], (uint8_t)c[1], (uint8_t)c[2]);
+	}
+
+	int width, height;
+	int spc;  // samples per column
+	uint64_t drawn;  // blocks drawn so far
+	uint64_t version;
+	std::vector<trace> traces;
+	cv::Mat img;
+};
+
+#endif
@@ -0,0 +1,181 @@
+#ifndef HOLE_FILL_H
+#define HOLE_FILL_H
+
+#include <opencv2/opencv.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+// Fills invalid (0) depth from valid neighbours without bridging depth
+// discontinuities.
+//
+// GUIDED     row runs of up to max_gap holes. Runs whose two ends are within
+//            edge mm of each other lie on one surface and are interpolated.
+//            Across a discontinuity every hole takes the end whose RGB color
+//            is closer to its own; without registered RGB it takes the far
+//            end, as holes next to an edge are mostly the background the
+//            foreground object shadows.
+// PUSH_PULL  a pyramid, log2(max_gap) levels deep. Pull averages the valid
+//            children within edge mm of the farthest one, push fills holes
+//            from the coarser level on the way back up.
+//
+// Every pass runs over row bands with cv::parallel_for_.
+class hole_fill {
+public:
+	enum mode { OFF, GUIDED, PUSH_PULL, MODE_COUNT };
+
+	explicit hole_fill(int bands = 8) :
+		mode(OFF), max_gap(32), edge(50), nbands(bands), guide(nullptr)
+	{
+	}
+
+	static const char * name(int m) {
+		static const char * names[MODE_COUNT] = { "off", "guided", "push-pull" };
+		return names[m];
+	}
+
+	// rgb guides GUIDED when it's registered to depth (same size, 8UC3).
+	void apply(const cv::Mat & depth, const cv::Mat & rgb, cv::Mat & out) {
+		CV_Assert(depth.type() == CV_16UC1);
+		depth.copyTo(out);
+		if (mode == GUIDED) {
+			guide = (rgb.size() == depth.size() && rgb.type() == CV_8UC3) ? &rgb : nullptr;
+			if (levels.empty()) levels.resize(1);
+			levels[0] = out;
+			run(&hole_fill::guidedRows, 0, out.rows);
+		} else if (mode == PUSH_PULL) {
+			pushPull(out);
+		}
+	}
+
+	int mode;
+	int max_gap;  // px
+	int edge;     // mm
+
+private:
+	typedef void (hole_fill::*rows_fn)(int level, int y0, int y1);
+
+	class band_body : public cv::ParallelLoopBody {
+	public:
+		band_body(hole_fill & fill, rows_fn fn, int level, int rows) :
+			fill(fill), fn(fn), level(level), rows(rows) {}
+
+		void operator()(const cv::Range & range) const {
+			for (int b = range.start; b < range.end; ++b) {
+				int y0 = rows * b / fill.nbands;
+				int y1 = rows * (b + 1) / fill.nbands;
+				(fill.*fn)(level, y0, y1);
+			}
+		}
+
+	private:
+		hole_fill & fill;
+		rows_fn fn;
+		int level, rows;
+	};
+
+	void run(rows_fn fn, int level, int rows) {
+		cv::parallel_for_(cv::Range(0, nbands), band_body(*this, fn, level, rows));
+	}
+
+	static int colorDist(const cv::Vec3b & a, const cv::Vec3b & b) {
+		return std::abs(a[0] - b[0]) + std::abs(a[1] - b[1]) + std::abs(a[2] - b[2]);
+	}
+
+	void guidedRows(int, int y0, int y1) {
+		cv::Mat & depth = levels[0];
+		int w = depth.cols;
+		for (int y = y0; y < y1; ++y) {
+			uint16_t * d = depth.ptr<uint16_t>(y);
+			const cv::Vec3b * c = guide ? guide->ptr<cv::Vec3b>(y) : nullptr;
+			int x = 0;
+			while (x < w) {
+				if (d[x] != 0) {
+					x++;
+					continue;
+				}
+				int a = x;
+				while (x < w && d[x] == 0) x++;
+				int b = x;
+				if (b - a > max_gap || (a == 0 && b == w)) continue;
+
+				int l = a > 0 ? d[a - 1] : 0;
+				int r = b < w ? d[b] : 0;
+				if (l == 0 || r == 0) {
+					// run touches the border, extend the one side
+					std::fill(d + a, d + b, (uint16_t)(l + r));
+				} else if (std::abs(l - r) <= edge) {
+					int n = b - a + 1;
+					for (int i = a; i < b; ++i) d[i] = l + (r - l) * (i - a + 1) / n;
+				} else if (c) {
+					for (int i = a; i < b; ++i) {
+						d[i] = colorDist(c[i], c[a - 1]) <= colorDist(c[i], c[b]) ? l : r;
+					}
+				} else {
+					std::fill(d + a, d + b, (uint16_t)std::max(l, r));
+				}
+			}
+		}
+	}
+
+	void pushPull(cv::Mat & depth) {
+		int n = 1;
+		while ((1 << (n - 1)) < max_gap && std::min(depth.cols, depth.rows) >> n > 0) n++;
+		levels.resize(n);
+		levels[0] = depth;
+		for (int k = 1; k < n; ++k) {
+			levels[k].create((levels[k - 1].rows + 1) / 2, (levels[k - 1].cols + 1) / 2, CV_16UC1);
+			run(&hole_fill::pullRows, k, levels[k].rows);
+		}
+		for (int k = n - 2; k >= 0; --k) {
+			run(&hole_fill::pushRows, k, levels[k].rows);
+		}
+	}
+
+	// level k from the valid children in level k - 1
+	void pullRows(int k, int y0, int y1) {
+		const cv::Mat & src = levels[k - 1];
+		cv::Mat & dst = levels[k];
+		for (int y = y0; y < y1; ++y) {
+			const uint16_t * s0 = src.ptr<uint16_t>(2 * y);
+			const uint16_t * s1 = src.ptr<uint16_t>(std::min(2 * y + 1, src.rows - 1));
+			uint16_t * o = dst.ptr<uint16_t>(y);
+			for (int x = 0; x < dst.cols; ++x) {
+				int x1 = std::min(2 * x + 1, src.cols - 1);
+				int c[4] = { s0[2 * x], s0[x1], s1[2 * x], s1[x1] };
+				int far = std::max(std::max(c[0], c[1]), std::max(c[2], c[3]));
+				int sum = 0, cnt = 0;
+				for (int i = 0; i < 4; ++i) {
+					if (c[i] != 0 && c[i] >= far - edge) {
+						sum += c[i];
+						cnt++;
+					}
+				}
+				o[x] = cnt ? (sum + cnt / 2) / cnt : 0;
+			}
+		}
+	}
+
+	// holes in level k from level k + 1
+	void pushRows(int k, int y0, int y1) {
+		cv::Mat & dst = levels[k];
+		const cv::Mat & src = levels[k + 1];
+		for (int y = y0; y < y1; ++y) {
+			uint16_t * d = dst.ptr<uint16_t>(y);
+			const uint16_t * s = src.ptr<uint16_t>(y / 2);
+			for (int x = 0; x < dst.cols; ++x) {
+				if (d[x] == 0) d[x] = s[x / 2];
+			}
+		}
+	}
+
+	int nbands;
+
+	// per apply() call
+	std::vector<cv::Mat> levels;
+	const cv::Mat * guide;
+};
+
+#endif
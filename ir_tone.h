@@ -0,0 +1,81 @@
+#ifndef IR_TONE_H
+#define IR_TONE_H
+
+#include <opencv2/opencv.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+// 10-bit IR to 8-bit BGR through a 1024-entry tone curve table. The table is
+// only rebuilt when the curve changes, so switching curves costs nothing per
+// frame and conversion is one pass straight into the 3-channel output.
+class ir_tone {
+public:
+	enum curve {
+		QUADRATIC,  // 255 * (1 - (x/1024 - 1)^2), brightens the dark end
+		LINEAR,
+		GAMMA,
+		CURVE_COUNT
+	};
+
+	ir_tone() : current(-1), current_gamma(0) {}
+
+	static const char * name(int c) {
+		static const char * names[CURVE_COUNT] = { "quadratic", "linear", "gamma" };
+		return names[c];
+	}
+
+	// Rebuilds the table if the curve or gamma changed.
+	void select(int c, double gamma = 2.2) {
+		if (c == current && gamma == current_gamma) return;
+		for (int x = 0; x < 1024; ++x) {
+			double v;
+			switch (c) {
+				case LINEAR:
+					v = x / 1023.0;
+					break;
+				case GAMMA:
+					v = std::pow(x / 1023.0, 1.0 / gamma);
+					break;
+				default: {
+					double t = x / 1024.0 - 1;
+					v = 1 - t * t;
+				}
+			}
+			uint8_t g = cv::saturate_cast<uint8_t>(v * 255);
+			// gray replicated to B, G, R (and a spare byte, see apply())
+			lut[x] = g * 0x01010101u;
+		}
+		current = c;
+		current_gamma = gamma;
+	}
+
+	// src: CV_16UC1 10-bit IR, out: CV_8UC3
+	void apply(const cv::Mat & src, cv::Mat & out) const {
+		out.create(src.size(), CV_8UC3);
+		for (int y = 0; y < src.rows; ++y) {
+			const uint16_t * s = src.ptr<uint16_t>(y);
+			uint8_t * o = out.ptr<uint8_t>(y);
+			int n = src.cols;
+			// 4-byte stores, each overwriting the spare byte of the previous one;
+			// the last pixel of the row is stored byte-wise to stay in bounds
+			for (int x = 0; x < n - 1; ++x) {
+				std::memcpy(o + x * 3, &lut[std::min<uint16_t>(s[x], 1023)], 4);
+			}
+			if (n > 0) {
+				uint32_t v = lut[std::min<uint16_t>(s[n - 1], 1023)];
+				std::memcpy(o + (n - 1) * 3, &v, 3);
+			}
+		}
+	}
+
+	int curveId() const { return current; }
+
+private:
+	uint32_t lut[1024];
+	int current;
+	double current_gamma;
+};
+
+#endif
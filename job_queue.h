@@ -0,0 +1,117 @@
+#ifndef JOB_QUEUE_H
+#define JOB_QUEUE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "slot_queue.h"
+
+// Fixed number of job slots worked off in order by background threads, for
+// handing frames (as frame_refs, never copies) to writers. push() takes a
+// free slot and returns at once; when every slot is waiting or in progress
+// the job is dropped and counted instead, so the caller never waits on the
+// workers. A slot is reset to Job() once its job is done, which lets go of
+// the frames it held.
+template<typename Job>
+class job_queue {
+public:
+	typedef std::function<void(Job &)> handler;
+
+	job_queue() : active(false), busy(0), dropped_cnt(0) {}
+
+	~job_queue() {
+		stop();
+	}
+
+	// threads workers call work for each job, at most slots jobs are held.
+	void start(size_t slots, size_t threads, handler work) {
+		stop();
+		this->work = work;
+		jobs.assign(slots, Job());
+		free_ids.reset(slots);
+		for (size_t i = 0; i < slots; ++i) free_ids.push(i);
+		pending.reset(slots);
+		busy = 0;
+		dropped_cnt = 0;
+		active = true;
+		for (size_t i = 0; i < threads; ++i) workers.emplace_back(&job_queue::run, this);
+	}
+
+	// Works off what's queued, then stops the threads.
+	void stop() {
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			active = false;
+		}
+		wake.notify_all();
+		for (size_t i = 0; i < workers.size(); ++i) workers[i].join();
+		workers.clear();
+	}
+
+	bool running() const { return active; }
+
+	// False when the job was dropped, or the queue isn't running.
+	bool push(Job job) {
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			if (!active) return false;
+			if (free_ids.empty()) {
+				dropped_cnt++;
+				return false;
+			}
+			size_t id = free_ids.pop();
+			jobs[id] = std::move(job);
+			pending.push(id);
+		}
+		wake.notify_one();
+		return true;
+	}
+
+	// waiting or in progress
+	size_t queued() {
+		std::lock_guard<std::mutex> lock(mtx);
+		return pending.size() + busy;
+	}
+
+	uint64_t dropped() const { return dropped_cnt; }
+
+private:
+	void run() {
+		std::unique_lock<std::mutex> lock(mtx);
+		for (;;) {
+			wake.wait(lock, [this] { return !pending.empty() || !active; });
+			if (pending.empty()) break;
+
+			size_t id = pending.pop();
+			busy++;
+			lock.unlock();
+
+			work(jobs[id]);
+			jobs[id] = Job();
+
+			lock.lock();
+			busy--;
+			free_ids.push(id);
+		}
+	}
+
+	handler work;
+	std::vector<Job> jobs;
+	slot_queue free_ids;
+	slot_queue pending;
+
+	std::vector<std::thread> workers;
+	std::mutex mtx;
+	std::condition_variable wake;
+	std::atomic<bool> active;
+	size_t busy;
+
+	std::atomic<uint64_t> dropped_cnt;
+};
+
+#endif
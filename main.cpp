@@ -1,11 +1,30 @@
-#include <libfreenect_sync.h>
 #include <opencv2/opencv.hpp>
 
 #include <chrono>
+#include <csignal>
+#include <memory>
+#include <mutex>
 #include <vector>
 #include <string>
+#include <thread>
 
 #include "date.h"
+#include "frame.h"
+#include "frame_ring.h"
+#include "capture.h"
+#include "pipeline.h"
+#include "commands.h"
+#include "recording.h"
+#include "depth_codec.h"
+#include "point_cloud.h"
+#include "snapshot_writer.h"
+#include "frame_source.h"
+#include "playback.h"
+#include "synthetic_source.h"
+#include "stage_timer.h"
+#include "probe_history.h"
+#include "history_plot.h"
+#include "alloc_counter.h"
 
 std::string strip(const std::string & str) {
 	std::string ret = str;
@@ -68,34 +87,80 @@ std::string timestamp() {
 	return date::format("%Y-%m-%d_%H-%M-%S", now);
 }
 
-cv::Mat getHist(cv::Mat depth, float rng = 5000) {
-	float range[] = { 1, rng } ;
-	const float* histRange = { range };
-	int histSize = 1000;
-	bool uniform = true;
-	bool accumulate = false;
-
-	cv::Mat hist;
-
-	cv::calcHist( &depth, 1, 0, cv::Mat(), hist, 1, &histSize, &histRange, uniform, accumulate );
-
-	return hist;
+void drawHist(const depth_hist & hist, cv::Mat & hist_image) {
+	int hh = 100, hw = 1000;
+	hist_image.create(hh+10, hw, CV_8UC3);
+	hist_image.setTo(cv::Scalar::all(0));
+	float hmin = hist.minCount(), hmax = hist.maxCount();
+	if (hmax <= hmin) return;
+	for (int i = 0; i < hist.bins(); i++) {
+		float v = hh * (hist.count(i) - hmin) / (hmax - hmin);
+		cv::line(hist_image, cv::Point(i, hh+10), cv::Point( i, hh - cvRound(v)), cv::Scalar::all(255));
+	}
 }
 
-cv::Mat drawHist(cv::Mat hist) {
+// Color strip laid under the histogram bars, one column per 5 mm bin. Depends
+// only on the colorizer range, so it is rebuilt when that changes.
+cv::Mat drawHistOverlay(const depth_colorizer & colorizer) {
 	int hh = 100, hw = 1000;
-	cv::Mat hist_image = cv::Mat::zeros(hh+10, hw, CV_8UC3);
-	cv::normalize(hist, hist, 0, hh, cv::NORM_MINMAX, -1, cv::Mat());
-	for (int i = 0; i < hist.size().height; i++) {
-		cv::line(hist_image, cv::Point(i, hh+10), cv::Point( i, hh - cvRound(hist.at<float>(i))), cv::Scalar::all(255));
+	cv::Mat overlay(hh+10, hw, CV_8UC3);
+	cv::Vec3b * row = overlay.ptr<cv::Vec3b>(0);
+	for (int i = 0; i < hw; ++i) {
+		row[i] = colorizer.color(i*5);
 	}
-	return hist_image;
+	for (int y = 1; y < overlay.rows; ++y) {
+		overlay.row(0).copyTo(overlay.row(y));
+	}
+	return overlay;
 }
 
 void putOn(cv::Mat dst, cv::Mat src, cv::Point origin) {
 	src.copyTo(dst(cv::Rect(origin.x,origin.y,src.cols, src.rows)));
 }
 
+void drawHelp(cv::Mat canvas) {
+	std::string help = 
+		"S X - save images, cloud\n"
+		"R T - record, save last secs\n"
+		"\n"
+		"A C - auto, continuous range\n"
+		"drag, r-click - add, del ROI\n"
+		"D V K - depth, video, skew drop\n"
+		"F O - filter, hole fill\n"
+		"G - IR tone curve\n"
+		"P , . - pause, step\n"
+		"I - timings\n"
+		"\n"
+		"Q - quit"
+	;
+
+	cv::rectangle(canvas, cv::Rect(6, 5, 198, 228), cv::Scalar::all(0), -1);
+	putTexts(canvas, help, {10, 20}, cv::FONT_HERSHEY_SIMPLEX, 0.45, cv::Scalar::all(255), 2);
+}
+
+// Stage timing table in place of the help text: min, mean and p99 in ms.
+void drawTimings(cv::Mat canvas, const frame_timer & timer) {
+	cv::rectangle(canvas, cv::Rect(6, 5, 198, 228), cv::Scalar::all(0), -1);
+	int y = 20;
+	putTexts(canvas, "ms", {10, y}, cv::FONT_HERSHEY_PLAIN, 0.8, cv::Scalar::all(255));
+	putTexts(canvas, "min", {95, y}, cv::FONT_HERSHEY_PLAIN, 0.8, cv::Scalar::all(255));
+	putTexts(canvas, "mean", {130, y}, cv::FONT_HERSHEY_PLAIN, 0.8, cv::Scalar::all(255));
+	putTexts(canvas, "p99", {170, y}, cv::FONT_HERSHEY_PLAIN, 0.8, cv::Scalar::all(255));
+	char buf[16];
+	for (int s = 0; s < STAGE_COUNT; ++s) {
+		const stage_stats & st = timer.get(s);
+		if (st.empty()) continue;
+		y += 15;
+		putTexts(canvas, stageName(s), {10, y}, cv::FONT_HERSHEY_PLAIN, 0.8, cv::Scalar::all(255));
+		double v[3] = { st.min(), st.mean(), st.p99() };
+		int x[3] = { 95, 130, 170 };
+		for (int i = 0; i < 3; ++i) {
+			std::snprintf(buf, sizeof(buf), "%.1f", v[i]);
+			putTexts(canvas, buf, {x[i], y}, cv::FONT_HERSHEY_PLAIN, 0.8, cv::Scalar::all(255));
+		}
+	}
+}
+
 void drawCanvas(cv::Mat canvas) {
 	int hist_x = 220, hist_y = 110;
 	int hh = 100 + 10;
@@ -105,17 +170,7 @@ void drawCanvas(cv::Mat canvas) {
 	}
 	putTextCentered(canvas, "mm", {hist_x + 1000 + 30, hist_y + hh+10}, cv::FONT_HERSHEY_PLAIN, 0.8, cv::Scalar::all(255));
 
-	std::string help = 
-		"S - save images\n"
-		"\n"
-		"A - auto range\n"
-		"D - depth mode\n"
-		"V - video mode\n"
-		"\n"
-		"Q - quit"
-	;
-
-	putTexts(canvas, help, {10, 20}, cv::FONT_HERSHEY_SIMPLEX, 0.5, cv::Scalar::all(255), 2);
+	drawHelp(canvas);
 	
 	cv::rectangle(canvas, cv::Rect(5, 4, 200, 230), cv::Scalar::all(222), 1);
 	
@@ -123,241 +178,1077 @@ void drawCanvas(cv::Mat canvas) {
 	cv::rectangle(canvas, cv::Rect(1075, 4, 200, 82), cv::Scalar::all(255), 1);
 }
 
+// Status strip along the bottom of the canvas, below the image panels.
+void drawStatus(cv::Mat canvas, const std::string & str) {
+	cv::Rect strip(0, canvas.rows - 40, canvas.cols, 40);
+	cv::rectangle(canvas, strip, cv::Scalar::all(0), -1);
+	putTexts(canvas, str, {10, strip.y + 16}, cv::FONT_HERSHEY_SIMPLEX, 0.45, cv::Scalar::all(255), 1.8);
+}
+
+// Mouse state in panel coordinates. A click moves the pixel readout and
+// queues a new probe, a drag queues a new ROI and a right click queues
+// removal of the probes and ROIs under it; the frame loop applies the
+// queued edits.
 struct mouse_pos {
-	mouse_pos() : x(-1), y(-1) {}
+	mouse_pos() : x(-1), y(-1), dragging(false) {}
 	int x;
 	int y;
-};
 
-cv::Mat drawHistory(cv::Mat history, int history_pos, int height = 100) {
-	cv::Mat out(height, history.size().width, CV_8UC3, cv::Scalar::all(0));
-
-	for (int c = 0; c < history.size().height; ++c) {
-		double hmin, hmax;
-		cv::Point l1, l2;
-		cv::Mat hmask = history.row(c) > 0;
-		cv::minMaxLoc(history.row(c), &hmin, &hmax, &l1, &l2, hmask);
-		float hrange = hmax - hmin;
-		hmin -= 0.05*hrange;
-		hmax += 0.05*hrange;
-		float prev_hv = history.at<short>(c, (history_pos) % history.size().width);
-		prev_hv = (prev_hv - hmin) / (hmax - hmin);
-		for (int i = 1; i < history.size().width; ++i) {
-			float hv =  history.at<short>(c, (history_pos + i) % history.size().width);
-			hv = (hv - hmin) / (hmax - hmin);
-			if (prev_hv > 0 && hv > 0) 
-				cv::line(out, {i, height*(1-prev_hv)}, {i, height*(1-hv)}, cv::Scalar::all(255));
-			prev_hv = hv;
-		}
-	}
-	return out;
-}
+	bool dragging;
+	cv::Point drag_start, drag_end;
+	std::vector<cv::Point> new_probes;
+	std::vector<cv::Rect> new_rois;
+	std::vector<cv::Point> remove_at;
+};
 
-static void onMouse( int event, int x, int y, int, void* data) {
+static void onMouse( int event, int x, int y, int flags, void* data) {
 	mouse_pos * mp = (mouse_pos*)data;
 	y = y - 240;
 	if (x > 640) x = x - 640;
+	x = std::min(std::max(x, 0), 639);
+	// above the panels is the histogram, below them the status strip
+	bool on_panel = y >= 0 && y <= 479;
 	if (event == cv::EVENT_LBUTTONDOWN) {
-		mp->x = x;
-		mp->y = y;
+		if (!on_panel) return;
+		mp->dragging = true;
+		mp->drag_start = mp->drag_end = {x, y};
+	} else if (event == cv::EVENT_MOUSEMOVE && mp->dragging && (flags & cv::EVENT_FLAG_LBUTTON)) {
+		mp->drag_end = {x, std::min(std::max(y, 0), 479)};
+	} else if (event == cv::EVENT_LBUTTONUP && mp->dragging) {
+		mp->dragging = false;
+		cv::Rect r(mp->drag_start, mp->drag_end);
+		if (r.width < 4 && r.height < 4) {
+			mp->x = mp->drag_start.x;
+			mp->y = mp->drag_start.y;
+			mp->new_probes.push_back(mp->drag_start);
+		} else {
+			mp->new_rois.push_back(r);
+		}
+	} else if (event == cv::EVENT_RBUTTONDOWN && on_panel) {
+		mp->remove_at.push_back({x, y});
 	}
 }
 
-int main(int argc, char * argv[]) {
-	short *depth = 0;
-	char *rgb = 0;
-	uint32_t ts;
-	int ret;
+// One line per ROI: depth over valid pixels, then RGB (as R G B).
+std::string roiStatus(const pipeline & pipe) {
+	std::string str;
+	char buf[160];
+	for (size_t i = 0; i < pipe.roi_results.size() && i < pipe.rois.size(); ++i) {
+		const roi_result & r = pipe.roi_results[i];
+		std::snprintf(buf, sizeof(buf), "roi %zu: %.1f +- %.1f mm [%d-%d] valid %.0f%%  rgb %.0f %.0f %.0f +- %.1f %.1f %.1f\n",
+			i + 1, r.depth_mean, r.depth_std, r.depth_min, r.depth_max, r.valid * 100,
+			r.rgb_mean[2], r.rgb_mean[1], r.rgb_mean[0], r.rgb_std[2], r.rgb_std[1], r.rgb_std[0]);
+		str += buf;
+	}
+	return str;
+}
 
-	int depth_min = 500;
-	int depth_range = 1500;
+// ROI outlines and their depth mean/std/valid fraction on a panel.
+void drawRois(cv::Mat panel, const pipeline & pipe, cv::Size frame, const mouse_pos & mp) {
+	for (size_t i = 0; i < pipe.rois.size(); ++i) {
+		const cv::Rect & f = pipe.rois[i];
+		cv::Rect r(f.x * panel.cols / frame.width, f.y * panel.rows / frame.height,
+			f.width * panel.cols / frame.width, f.height * panel.rows / frame.height);
+		cv::rectangle(panel, r, cv::Scalar(0, 255, 255), 1);
+		if (i >= pipe.roi_results.size()) continue;
+		const roi_result & res = pipe.roi_results[i];
+		char buf[64];
+		std::snprintf(buf, sizeof(buf), "%zu: %.0f+-%.0f %.0f%%", i + 1, res.depth_mean, res.depth_std, res.valid * 100);
+		cv::putText(panel, buf, {r.x, std::max(r.y - 3, 10)}, cv::FONT_HERSHEY_PLAIN, 0.8, cv::Scalar(0, 255, 255));
+	}
+	if (mp.dragging) cv::rectangle(panel, cv::Rect(mp.drag_start, mp.drag_end), cv::Scalar::all(255), 1);
+}
 
-	bool depth_aligned = true;
-	bool video_ir = false;
+void drawProbes(cv::Mat panel, const probe_history & probes, cv::Size frame) {
+	for (size_t i = 0; i < probes.size(); ++i) {
+		cv::Point p(probes[i].pos.x * panel.cols / frame.width, probes[i].pos.y * panel.rows / frame.height);
+		cv::circle(panel, p, 4, probes[i].color, 1, CV_AA);
+		cv::putText(panel, probes[i].name, p + cv::Point(6, -6), cv::FONT_HERSHEY_PLAIN, 0.8, probes[i].color);
+	}
+}
 
-	int blend_ratio = 50;
+std::string probeStatus(const probe_history & probes) {
+	std::string str;
+	for (size_t i = 0; i < probes.size(); ++i) {
+		str += (i ? "  " : "probes: ") + probes[i].name + " " + std::to_string(probes.last(i));
+	}
+	return str.empty() ? str : str + "\n";
+}
 
-	int index = 0;
+static volatile std::sig_atomic_t quit_requested = 0;
 
-	bool sim = false;
+static void onSignal(int) {
+	quit_requested = 1;
+}
 
-	const cv::String keys =
-		"{help h usage ? |      | print this message   }"
-		"{@rgb           |      | rgb image            }"
-		"{@depth         |      | depth image          }"
-		"{device         |0     | device id            }"
-        ;
+// Frames per second, refreshed once a second.
+class fps_meter {
+public:
+	fps_meter() : frames(0), value(0), start(std::chrono::steady_clock::now()) {}
 
-	cv::CommandLineParser parser(argc, argv, keys);
-	parser.about("KinectViewer v0.0.1");
-	if (parser.has("help"))
-	{
-	    parser.printMessage();
-	    return 0;
+	// Count a frame, returns true when a new reading is available.
+	bool tick() {
+		frames++;
+		auto now = std::chrono::steady_clock::now();
+		double elapsed = std::chrono::duration<double>(now - start).count();
+		if (elapsed < 1.0) return false;
+		value = frames / elapsed;
+		frames = 0;
+		start = now;
+		return true;
 	}
-	index = parser.get<int>("device");
-	cv::String img1 = parser.get<cv::String>(0);
-	cv::String img2 = parser.get<cv::String>(1);
-	if (!parser.check())
-	{
-	    parser.printErrors();
-	    return 0;
+
+	double fps() const { return value; }
+
+private:
+	int frames;
+	double value;
+	std::chrono::steady_clock::time_point start;
+};
+
+// Frames each holder of pool slots keeps at most. The pool covers all of
+// them, so writers backed up by a slow disk drop their own frames instead
+// of starving capture and with it the display.
+static const size_t RING_FRAMES = 3;
+static const size_t REC_SLOTS = 30;
+static const size_t PRE_SLOTS = 8;
+static const size_t CLOUD_SLOTS = 4;
+static const size_t SNAP_SLOTS = 8;
+// ring items (capacity + 2) plus the displayed frame
+static const size_t POOL_FRAMES = RING_FRAMES + 2 + 1 + REC_SLOTS + PRE_SLOTS + CLOUD_SLOTS + SNAP_SLOTS;
+
+// Everything the front ends and the key handler work on. Members are ordered
+// so the acquisition thread stops first, then the writers drain their queued
+// frames, which may be views into the source (playback maps the recording),
+// before the source goes away; the pool outlives every frame_ref.
+struct session {
+	session() :
+		pool(POOL_FRAMES), ring(RING_FRAMES), rec(REC_SLOTS), pre(PRE_SLOTS), clouds(CLOUD_SLOTS),
+		snaps(2, SNAP_SLOTS), cap(ring, pool), show_timings(false), device(nullptr), player(nullptr) {
+		cap.recordTo(&rec);
+		pipe.timer = &timer;
 	}
 
-	cv::Mat sim_rgb, sim_depth;
-	if (!img1.empty() && !img2.empty()) {
-		std::cout << "Reading images" << std::endl;
-		sim_rgb = cv::imread(img1);
-		if (sim_rgb.empty()) {
-			std::cerr << "Can't read rgb image: " << img1 << std::endl;
-			return -1;
+	void setSource(frame_source * src) {
+		source.reset(src);
+		cap.setSource(src);
+	}
+
+	frame_pool pool;
+	frame_ring<frame_ref> ring;
+	std::unique_ptr<frame_source> source;
+	recorder rec;
+	pretrigger pre;
+	cloud_writer clouds;
+	snapshot_writer snaps;
+	probe_history probes;
+	capture cap;
+	pipeline pipe;
+	settings s;
+
+	frame_timer timer;
+	bool show_timings;
+
+	// appended to saved file names to tell devices apart, empty with one
+	std::string tag;
+
+	// the source again, for source specific controls; null if it's another kind
+	freenect_source * device;
+	playback * player;
+};
+
+// "rec.kvr" with tag "_dev1" is "rec_dev1.kvr"
+std::string taggedPath(const std::string & path, const std::string & tag) {
+	size_t dot = path.find_last_of('.');
+	size_t slash = path.find_last_of('/');
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) return path + tag;
+	return path.substr(0, dot) + tag + path.substr(dot);
+}
+
+// Queued to the snapshot writers, the frame is shared rather than copied.
+void saveFrame(const frame_ref & f, session & ses) {
+	if (!ses.snaps.save(f, timestamp() + ses.tag)) std::cerr << "Snapshot dropped, writers busy" << std::endl;
+}
+
+void toggleRecording(recorder & rec, const std::string & tag) {
+	if (rec.recording()) {
+		rec.stop();
+		std::cout << "Recorded " << rec.written() << " frames to " << rec.path() << ", dropped " << rec.dropped() <<
+			", depth at " << (int)(rec.depthRatio() * 100 + 0.5) << "%" << (rec.failed() ? ", WRITE FAILED" : "") << std::endl;
+	} else {
+		rec.start(timestamp() + tag + ".kvr");
+	}
+}
+
+std::string playbackStatus(const session & ses) {
+	if (!ses.player) return "";
+	return "   play: " + std::to_string(ses.player->position() + 1) + "/" + std::to_string(ses.player->size());
+}
+
+std::string recordingStatus(recorder & rec) {
+	if (!rec.recording()) return "";
+	return "   REC " + rec.path() + ": " + std::to_string(rec.written()) +
+		" written, " + std::to_string(rec.queued()) + " queued, " + std::to_string(rec.dropped()) + " dropped" +
+		(rec.failed() ? ", WRITE FAILED" : "");
+}
+
+std::string pretriggerStatus(pretrigger & pre) {
+	if (!pre.enabled()) return "";
+	char buf[96];
+	std::snprintf(buf, sizeof(buf), "   pre: %.1f s, %zu/%zu MB", pre.span(), pre.usedBytes() >> 20, pre.budget() >> 20);
+	std::string str = buf;
+	if (pre.saving()) str += ", saving " + std::to_string(pre.saved());
+	if (pre.dropped()) str += ", " + std::to_string(pre.dropped()) + " dropped";
+	return str;
+}
+
+// Frame slots held by the ring, recorder and display; starved counts
+// frames lost because none were free.
+std::string poolStatus(frame_pool & pool) {
+	std::string str = "   pool: " + std::to_string(pool.size() - pool.available()) + "/" + std::to_string(pool.size());
+	if (pool.starved()) str += " (" + std::to_string(pool.starved()) + " starved)";
+	return str;
+}
+
+std::string cloudStatus(cloud_writer & clouds) {
+	if (!clouds.continuous && !clouds.queued()) return "";
+	return "   clouds: " + std::to_string(clouds.written()) + " written, " + std::to_string(clouds.queued()) +
+		" queued, " + std::to_string(clouds.dropped()) + " dropped, " + std::to_string(clouds.lastPoints()) + " pts";
+}
+
+// Snapshots being written, and the last one saved for a few seconds after.
+std::string snapshotStatus(snapshot_writer & snaps) {
+	size_t queued = snaps.queued();
+	double age;
+	std::string last = snaps.last(age);
+	bool recent = !last.empty() && age < 3;
+	if (!queued && !recent) return "";
+	std::string str = "   snap: " + std::to_string(queued) + " queued";
+	if (recent) {
+		char buf[32];
+		std::snprintf(buf, sizeof(buf), " (%.0f ms)", snaps.lastMs());
+		str += ", saved " + last + buf;
+	}
+	uint64_t lost = snaps.dropped() + snaps.failed();
+	if (lost) str += ", " + std::to_string(lost) + " lost";
+	return str;
+}
+
+// Continuous export names the files by sequence number, saved frames by time.
+void exportCloud(const frame_ref & f, session & ses) {
+	cloud_writer & clouds = ses.clouds;
+	if (!clouds.continuous) return;
+	clouds.save(f, clouds.dir + "/cloud" + ses.tag + "_" + std::to_string(f->seq) + ".ply");
+}
+
+// RGB/depth skew of the device's pairs, mean and max over the last ones.
+std::string pairingStatus(const session & ses, const frame & f) {
+	if (!ses.device) return "";
+	skew_stats::summary sk = ses.device->pairing.stats.get();
+	char buf[128];
+	std::snprintf(buf, sizeof(buf), "   skew: %.1f mean %.1f max %.1f ms", f.skewMs(), sk.mean, sk.max);
+	std::string str = buf;
+	if (sk.over) {
+		str += ", " + std::to_string(sk.over) + " over " + std::to_string((int)ses.device->pairing.max_skew_ms) +
+			", " + std::to_string(sk.dropped) + " dropped";
+	}
+	if (f.skewed) str += " SKEWED";
+	return str;
+}
+
+// Heap allocations during the last frame, by the frame loop's own thread and
+// by all threads, only with COUNT_ALLOCS builds.
+struct frame_allocs {
+	frame_allocs() : loop(0), all(0), loop_before(0), all_before(0) {}
+
+	void begin() {
+		loop_before = threadAllocCount();
+		all_before = allocCount();
+	}
+
+	void end() {
+		loop = threadAllocCount() - loop_before;
+		all = allocCount() - all_before;
+	}
+
+	uint64_t loop, all;
+
+private:
+	uint64_t loop_before, all_before;
+};
+
+std::string allocStatus(const frame_allocs & allocs) {
+#ifdef COUNT_ALLOCS
+	return "   allocs/frame: " + std::to_string(allocs.loop) + " loop, " + std::to_string(allocs.all) + " all";
+#else
+	(void)allocs;
+	return "";
+#endif
+}
+
+std::string fillViewsName(int views) {
+	std::string str;
+	if (views & pipeline::FILL_DEPTH) str += " depth";
+	if (views & pipeline::FILL_BLEND) str += " rgb";
+	return str;
+}
+
+// Actions shared by the keyboard and stdin. Returns false on quit.
+bool handleKey(char ch, const frame_ref & f, session & ses) {
+	switch(ch) {
+		case 27:
+		case 'q':
+			return false;
+		case 's':
+		case 'S':
+			saveFrame(f, ses);
+			break;
+		case 'x':
+			ses.clouds.save(f, timestamp() + ses.tag + ".ply");
+			break;
+		case 'X':
+			ses.clouds.continuous = !ses.clouds.continuous;
+			break;
+		case 'r':
+			toggleRecording(ses.rec, ses.tag);
+			break;
+		case 't':
+			if (ses.pre.enabled() && !ses.pre.trigger(timestamp() + ses.tag + "_clip.kvr")) {
+				std::cout << "Pre-trigger clip still saving" << std::endl;
+			}
+			break;
+		case 'a':
+			ses.pipe.autoRange(ses.s);
+			break;
+		case 'c':
+			ses.pipe.tracker.toggle();
+			break;
+		case 'd':
+			if (ses.device) ses.device->depth_aligned = !ses.device->depth_aligned;
+			break;
+		case 'v':
+			if (ses.device) ses.device->video_ir = !ses.device->video_ir;
+			break;
+		case 'k':
+			if (ses.device) {
+				frame_pairing & pairing = ses.device->pairing;
+				pairing.drop_skewed = !pairing.drop_skewed;
+				std::cout << "Skewed pairs: " << (pairing.drop_skewed ? "dropped" : "flagged") << std::endl;
+			}
+			break;
+		case 'g':
+			if (ses.device) {
+				ses.device->ir_curve = (ses.device->ir_curve + 1) % ir_tone::CURVE_COUNT;
+				std::cout << "IR tone curve: " << ir_tone::name(ses.device->ir_curve) << std::endl;
+			}
+			break;
+		case 'f': {
+			depth_filter & filter = ses.pipe.filter;
+			filter.mode = (filter.mode + 1) % depth_filter::MODE_COUNT;
+			std::cout << "Temporal filter: " << depth_filter::name(filter.mode) << std::endl;
+			break;
+		}
+		case 'o': {
+			hole_fill & fill = ses.pipe.fill;
+			fill.mode = (fill.mode + 1) % hole_fill::MODE_COUNT;
+			std::cout << "Hole fill: " << hole_fill::name(fill.mode) << std::endl;
+			break;
 		}
+		case 'O':
+			ses.pipe.fill_views = ses.pipe.fill_views % pipeline::FILL_BOTH + 1;
+			std::cout << "Hole fill views:" << fillViewsName(ses.pipe.fill_views) << std::endl;
+			break;
+		case 'h':
+			ses.probes.clear();
+			break;
+		case 'i':
+			ses.show_timings = !ses.show_timings;
+			break;
+		case 'p':
+			if (ses.player) ses.player->togglePause();
+			break;
+		case ',':
+			if (ses.player) ses.player->step(-1);
+			break;
+		case '.':
+			if (ses.player) ses.player->step(1);
+			break;
+	}
+	return true;
+}
 
-		sim_depth = cv::imread(img2, -1);
-		if (sim_rgb.empty()) {
-			std::cerr << "Can't read depth image: " << img1 << std::endl;
-			return -1;
+// stdin command: either "<name> <value>" for a setting or a single key.
+bool handleCommand(const std::string & cmd, const frame_ref & f, session & ses) {
+	settings & s = ses.s;
+	std::stringstream ss(cmd);
+	std::string name;
+	int value;
+	ss >> name;
+	if (ss >> value) {
+		if (name == "min") s.depth_min = value;
+		else if (name == "range") s.depth_range = value;
+		else if (name == "blend") s.blend_ratio = std::min(std::max(value, 0), 100);
+		else if (name == "seek" && ses.player) ses.player->seek(value);
+		else std::cerr << "Unknown setting: " << name << std::endl;
+		return true;
+	}
+	return handleKey(name[0], f, ses);
+}
+
+int runHeadless(session & ses) {
+	frame_ring<frame_ref> & ring = ses.ring;
+	pipeline & pipe = ses.pipe;
+	fps_meter fps;
+
+	// outlives the loop, its thread may still be blocked on stdin at exit
+	static command_reader commands;
+	commands.start();
+
+	uint64_t processed = 0;
+	frame_allocs allocs;
+	auto start = std::chrono::steady_clock::now();
+
+	frame_ref cur;
+	while (!quit_requested) {
+		if (ses.cap.failed()) return -1;
+
+		frame_ref * next = ring.pop();
+		if (!next) {
+			if (ses.cap.finished()) break;
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			continue;
+		}
+		cur = std::move(*next);
+		ring.release(next);
+		exportCloud(cur, ses);
+
+		allocs.begin();
+		ses.timer.add(STAGE_ACQUIRE, cur->grab_ms);
+		ses.timer.add(STAGE_CONVERT, cur->convert_ms);
+		pipe.process(*cur, ses.s);
+		ses.probes.sample(pipe.depth);
+		ses.timer.endFrame();
+		processed++;
+		allocs.end();
+
+		std::string cmd;
+		while (commands.poll(cmd)) {
+			if (!handleCommand(cmd, cur, ses)) quit_requested = 1;
+		}
+
+		if (fps.tick()) {
+			std::cout << "fps: " << fps.fps() << "  frames: " << ring.pushed() << "  dropped: " << ring.dropped();
+			if (pipe.tracker.enabled) std::cout << "  range: " << pipe.tracker.low() << "-" << pipe.tracker.high();
+			std::cout << playbackStatus(ses) << pairingStatus(ses, *cur) << recordingStatus(ses.rec) << pretriggerStatus(ses.pre) << snapshotStatus(ses.snaps) << cloudStatus(ses.clouds) << poolStatus(ses.pool) << allocStatus(allocs) << std::endl;
+			std::cout << probeStatus(ses.probes) << roiStatus(pipe);
+			if (ses.show_timings) std::cout << ses.timer.report();
 		}
-		sim = true;
 	}
 
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "Processed " << processed << " frames in " << elapsed << " s (" << processed / elapsed << " fps)" << std::endl;
+	return 0;
+}
+
+#ifndef NO_HIGHGUI
+int runGui(session & ses) {
+	frame_ring<frame_ref> & ring = ses.ring;
+	pipeline & pipe = ses.pipe;
+	settings & s = ses.s;
 
 	cv::namedWindow("KinectViewer");
-	cv::createTrackbar("min", "KinectViewer", &depth_min, 10000, NULL);
-	cv::createTrackbar("range", "KinectViewer", &depth_range, 10000, NULL);
-	cv::createTrackbar("blend", "KinectViewer", &blend_ratio, 100, NULL);
+	cv::createTrackbar("min", "KinectViewer", &s.depth_min, 10000, NULL);
+	cv::createTrackbar("range", "KinectViewer", &s.depth_range, 10000, NULL);
+	cv::createTrackbar("blend", "KinectViewer", &s.blend_ratio, 100, NULL);
+	int shown_min = s.depth_min, shown_range = s.depth_range;
 	
 	mouse_pos mp;
     cv::setMouseCallback( "KinectViewer", onMouse, &mp );
 
 
-	cv::Mat canvas(720, 1280, CV_8UC3, cv::Scalar::all(0));
+	cv::Mat canvas(760, 1280, CV_8UC3, cv::Scalar::all(0));
 	drawCanvas(canvas);
 
-	int history_size = 800;
-	cv::Mat history(1, history_size, CV_16UC1, cv::Scalar::all(0));
-	int history_pos = 0;
+	cv::Mat hist_overlay;
+	history_plot plot;
+	fps_meter fps;
+	bool timings_shown = false;
+	frame_allocs allocs;
 
-	while(1) {
-		cv::Mat cv_rgb, cv_depth;
-		if (sim) {
-			cv_rgb = sim_rgb.clone();
-			cv_depth = sim_depth.clone();
-		} else {
-			if (video_ir) {
-				ret = freenect_sync_get_video((void**)&rgb, &ts, index, FREENECT_VIDEO_IR_10BIT);
-				cv::Mat tmp_rgb(480, 640, CV_16UC1, rgb);
-				cv::Mat tmp_ir;
-				tmp_rgb.convertTo(tmp_ir, CV_32FC1);
-				tmp_ir = tmp_ir / 1024 - 1;
-				tmp_ir = tmp_ir.mul(tmp_ir);
-				tmp_ir = -(tmp_ir - 1) * 255;
-				tmp_ir.convertTo(tmp_rgb, CV_8UC1);
-				cv::cvtColor(tmp_rgb, cv_rgb, cv::COLOR_GRAY2BGR);
-			} else {
-				ret = freenect_sync_get_video((void**)&rgb, &ts, index, FREENECT_VIDEO_RGB);
-				cv::Mat tmp_rgb(480, 640, CV_8UC3, rgb);
-				cv::cvtColor(tmp_rgb, cv_rgb, cv::COLOR_RGB2BGR);
+	frame_ref cur;
+	while(!quit_requested) {
+		if (ses.cap.failed()) return -1;
+
+		frame_ref * next = ring.pop();
+		bool fresh = next != nullptr;
+		if (fresh) {
+			cur = std::move(*next);
+			ring.release(next);
+			exportCloud(cur, ses);
+			fps.tick();
+		}
+		if (!cur) {
+			cv::waitKey(5);
+			continue;
+		}
+
+		allocs.begin();
+		frame_timer & timer = ses.timer;
+		if (fresh) {
+			timer.add(STAGE_ACQUIRE, cur->grab_ms);
+			timer.add(STAGE_CONVERT, cur->convert_ms);
+		}
+
+		// queued ROI edits, panel to frame coordinates
+		cv::Size frame_size = cur->depth.size(), panel = pipe.ws.panel;
+		for (const cv::Rect & r : mp.new_rois) {
+			pipe.rois.push_back(cv::Rect(r.x * frame_size.width / panel.width, r.y * frame_size.height / panel.height,
+				r.width * frame_size.width / panel.width, r.height * frame_size.height / panel.height));
+		}
+		for (const cv::Point & p : mp.new_probes) {
+			ses.probes.add("", cv::Point(p.x * frame_size.width / panel.width, p.y * frame_size.height / panel.height));
+		}
+		for (const cv::Point & p : mp.remove_at) {
+			cv::Point fp(p.x * frame_size.width / panel.width, p.y * frame_size.height / panel.height);
+			ses.probes.removeNear(fp, 8 * frame_size.width / panel.width);
+			for (size_t i = pipe.rois.size(); i-- > 0; ) {
+				if (pipe.rois[i].contains(fp)) pipe.rois.erase(pipe.rois.begin() + i);
+			}
+		}
+		mp.new_probes.clear();
+		mp.new_rois.clear();
+		mp.remove_at.clear();
+
+		pipe.process(*cur, s, fresh);
+		if (fresh) ses.probes.sample(pipe.depth);
+		cv::Mat cv_rgb = cur->rgb, cv_depth = pipe.depth;
+		frame_workspace & ws = pipe.ws;
+		cv::Mat & col_depth = ws.col_depth;
+		cv::Mat & hist_img = ws.hist_img;
+		{
+			scoped_timer t(&timer, STAGE_DRAW_HIST);
+			if (pipe.range_changed || hist_overlay.empty()) {
+				hist_overlay = drawHistOverlay(pipe.colorizer);
+			}
+			drawHist(pipe.hist, hist_img);
+
+			hist_overlay.copyTo(hist_img, hist_img);
+			cv::line(hist_img, {s.depth_min/5, 100}, {s.depth_min/5, 110}, cv::Scalar::all(255));
+			cv::line(hist_img, {(s.depth_min+s.depth_range)/5, 100}, {(s.depth_min+s.depth_range)/5, 110}, cv::Scalar::all(255));
+		}
+
+		{
+			scoped_timer t(&timer, STAGE_COMPOSE);
+
+			// panels are 640x480, frames of any other size are scaled to fit
+			cv::Point px(mp.x * cv_depth.cols / panel.width, mp.y * cv_depth.rows / panel.height);
+
+			cv::rectangle(canvas, cv::Rect(1100, 5, 150, 80), cv::Scalar::all(0), -1);
+			if (mp.y >= 0) {
+				int d = cv_depth.at<short>(px.y, px.x);
+				auto bgr = cv_rgb.at<cv::Vec3b>(px.y, px.x);
+				std::string pixel_str = std::to_string(bgr[2]) + "\n" + std::to_string(bgr[1]) + "\n" +
+					std::to_string(bgr[0]) + "\n" + std::to_string(d);
+				putTexts(canvas, pixel_str, {1100, 20}, cv::FONT_HERSHEY_SIMPLEX, 0.5, cv::Scalar::all(255), 2);
+				cv::rectangle(canvas, {1150,5,60,60}, cv::Scalar(bgr), -1);
+				cv::rectangle(canvas, {1150,65,60,20}, col_depth.at<cv::Vec3b>(px.y, px.x), -1);
 			}
 
-			if (depth_aligned) {
-				ret = freenect_sync_get_depth((void**)&depth, &ts, index, FREENECT_DEPTH_REGISTERED);
-			} else {
-				ret = freenect_sync_get_depth((void**)&depth, &ts, index, FREENECT_DEPTH_MM);
+			std::string status = "fps: " + std::to_string((int)fps.fps()) +
+				"   frames: " + std::to_string(ring.pushed()) +
+				"   dropped: " + std::to_string(ring.dropped());
+			if (pipe.filter.mode != depth_filter::OFF) {
+				status += "   filter: " + std::string(depth_filter::name(pipe.filter.mode));
 			}
-			cv::Mat tmp_depth(480, 640, CV_16UC1, depth);
-			cv_depth = tmp_depth;
-		}
-		
-		cv::Mat out_depth = cv_depth - depth_min; 
-		cv::Mat valid_mask = (cv_depth != 0);
-		cv::Mat depth_mask = (cv_depth >= depth_min) & (cv_depth <= depth_min + depth_range) & valid_mask;
-		cv::convertScaleAbs(out_depth, out_depth, 255./depth_range);
-		cv::Mat col_depth, tmp_depth;
-		cv::applyColorMap(out_depth, tmp_depth, cv::COLORMAP_JET);
-		tmp_depth.copyTo(col_depth, valid_mask);
-
-		cv::Mat out_rgb, tmp_rgb;
-		cv_rgb.copyTo(tmp_rgb, depth_mask);
-		cv::addWeighted(cv_rgb, 0.01 * blend_ratio, tmp_rgb, 0.01 * (100-blend_ratio), 0, out_rgb);
-
-		cv::Mat hist = getHist(cv_depth);
-		cv::Mat hist_img = drawHist(hist);
-		
-		cv::Mat hist_overlay = cv::Mat::zeros(hist_img.size(), CV_8UC3);
-		cv::Mat hist_depth = cv::Mat::zeros(hist_img.size(), CV_16UC1);
-		for (int i = 0; i < 1200; ++i) {
-			cv::line(hist_depth, {i, 0}, {i, hist_depth.size().height}, cv::Scalar::all(i*5));
-		}
-		hist_depth = hist_depth - depth_min;
-		cv::convertScaleAbs(hist_depth, hist_depth, 255./depth_range);
-		cv::applyColorMap(hist_depth, hist_overlay, cv::COLORMAP_JET);
-		
-		hist_overlay.copyTo(hist_img, hist_img);
-		cv::line(hist_img, {depth_min/5, 100}, {depth_min/5, 110}, cv::Scalar::all(255));
-		cv::line(hist_img, {(depth_min+depth_range)/5, 100}, {(depth_min+depth_range)/5, 110}, cv::Scalar::all(255));
-
-		cv::rectangle(canvas, cv::Rect(1100, 5, 150, 80), cv::Scalar::all(0), -1);
-		if (mp.y >= 0) {
-			int d = cv_depth.at<short>(mp.y, mp.x);
-			auto bgr = cv_rgb.at<cv::Vec3b>(mp.y, mp.x);
-			std::string pixel_str = std::to_string(bgr[2]) + "\n" + std::to_string(bgr[1]) + "\n" +
-				std::to_string(bgr[0]) + "\n" + std::to_string(d);
-			putTexts(canvas, pixel_str, {1100, 20}, cv::FONT_HERSHEY_SIMPLEX, 0.5, cv::Scalar::all(255), 2);
-			cv::rectangle(canvas, {1150,5,60,60}, cv::Scalar(bgr), -1);
-			cv::rectangle(canvas, {1150,65,60,20}, col_depth.at<cv::Vec3b>(mp.y, mp.x), -1);
-			history.at<short>(0, history_pos) = d;
-			history_pos++;
-			history_pos %= history_size;
-		}
-
-		drawPoint(out_rgb, {mp.x, mp.y});
-		drawPoint(col_depth, {mp.x, mp.y});
-		putOn(canvas, out_rgb, {0, 240});
-		putOn(canvas, col_depth, {640, 240});
-		putOn(canvas, hist_img, {220, 110});
-		putOn(canvas, drawHistory(history, history_pos), {215, 10});
-		cv::imshow("KinectViewer", canvas);
+			if (pipe.fill.mode != hole_fill::OFF) {
+				status += "   fill: " + std::string(hole_fill::name(pipe.fill.mode)) + " on" + fillViewsName(pipe.fill_views);
+			}
+			if (pipe.tracker.enabled) {
+				status += "   auto range: " + std::to_string((int)pipe.tracker.low()) + "-" + std::to_string((int)pipe.tracker.high()) + " mm";
+			}
+			status += playbackStatus(ses) + pairingStatus(ses, *cur) + recordingStatus(ses.rec) + pretriggerStatus(ses.pre) + snapshotStatus(ses.snaps) + cloudStatus(ses.clouds) + poolStatus(ses.pool) + allocStatus(allocs);
+			drawStatus(canvas, status);
+
+			cv::Mat panel_rgb = ws.out_rgb, panel_depth = ws.col_depth;
+			if (ws.size != panel) {
+				cv::resize(ws.out_rgb, ws.panel_rgb, panel, 0, 0, cv::INTER_AREA);
+				cv::resize(ws.col_depth, ws.panel_depth, panel, 0, 0, cv::INTER_NEAREST);
+				panel_rgb = ws.panel_rgb;
+				panel_depth = ws.panel_depth;
+			}
+			drawPoint(panel_rgb, {mp.x, mp.y});
+			drawPoint(panel_depth, {mp.x, mp.y});
+			drawRois(panel_rgb, pipe, cv_depth.size(), mp);
+			drawRois(panel_depth, pipe, cv_depth.size(), mp);
+			drawProbes(panel_rgb, ses.probes, cv_depth.size());
+			drawProbes(panel_depth, ses.probes, cv_depth.size());
+			putOn(canvas, panel_rgb, {0, 240});
+			putOn(canvas, panel_depth, {640, 240});
+			putOn(canvas, hist_img, {220, 110});
+			if (ses.show_timings) {
+				drawTimings(canvas, timer);
+			} else if (timings_shown) {
+				drawHelp(canvas);
+			}
+			timings_shown = ses.show_timings;
+		}
+		{
+			scoped_timer t(&timer, STAGE_DRAW_HISTORY);
+			plot.update(ses.probes);
+			putOn(canvas, plot.image(), {215, 10});
+		}
+		{
+			scoped_timer t(&timer, STAGE_SHOW);
+			cv::imshow("KinectViewer", canvas);
+		}
 
 		int key = cv::waitKey(5);
 //		if (key > 0) std::cout << key << "|" << (key & 0xff) << std::endl;
 		char ch = key & 0xff;
 
-		switch(ch) {
-			case 27:
-			case 'q':
-				return 0;
-			case 's':
-			case 'S': {
-					auto ts = timestamp();
-					cv::imwrite(ts + "_d.png", cv_depth);
-					cv::imwrite(ts + "_c.png", cv_rgb);
-					break;
-				}
-			case 'a': {
-					float hist_sum = cv::sum(hist)[0];
-					cv::Mat accumulatedHist = hist.clone();
-					for (int i = 1; i < hist.size().height; i++) {
-						accumulatedHist.at<float>(i) += accumulatedHist.at<float>(i - 1);
-						if (accumulatedHist.at<float>(i) < 0.001 * hist_sum) depth_min = i*5;
-						if (accumulatedHist.at<float>(i) < 0.999 * hist_sum) depth_range = i*5 - depth_min;
-					}
-					cv::setTrackbarPos("min", "KinectViewer", depth_min);
-					cv::setTrackbarPos("range", "KinectViewer", depth_range);
-					break;
-				}
-			case 'd':
-				depth_aligned = !depth_aligned;
-				break;
-			case 'v':
-				video_ir = !video_ir;
-				break;
-			case 'h':
-				history_pos = 0;
-				history = cv::Mat::zeros(history.size(), CV_16UC1);
-				break;
-		}	
+		if (key >= 0 && !handleKey(ch, cur, ses)) {
+			return 0;
+		}
+		timer.endFrame();
+		allocs.end();
+
+		if (s.depth_min != shown_min || s.depth_range != shown_range) {
+			cv::setTrackbarPos("min", "KinectViewer", s.depth_min);
+			cv::setTrackbarPos("range", "KinectViewer", s.depth_range);
+			shown_min = s.depth_min;
+			shown_range = s.depth_range;
+		}
 	}
 	
 	return 0;
 }
+#endif
+
+// One device of a multi-device run: its own session (capture thread, ring,
+// pipeline, recorder) plus a worker thread that processes its frames and
+// leaves tile sized panels for the canvas. Devices share nothing but the
+// canvas, so throughput scales with cores.
+struct device_lane {
+	device_lane() : processed(0), running(false) {}
+
+	~device_lane() {
+		stop();
+	}
+
+	// tile is the panel size for the canvas, empty when headless
+	void start(cv::Size tile_size) {
+		tile = tile_size;
+		ses.cap.start();
+		running = true;
+		worker = std::thread(&device_lane::run, this);
+	}
+
+	void stop() {
+		running = false;
+		if (worker.joinable()) worker.join();
+	}
+
+	session ses;
+
+	// ses.pipe, ses.s and ses.probes are shared with key handling, cur and
+	// the tiles with the canvas
+	std::mutex mtx;
+	frame_ref cur;
+	cv::Mat tile_rgb, tile_depth;
+	fps_meter fps;
+	std::atomic<uint64_t> processed;
+
+private:
+	void run() {
+		while (running) {
+			frame_ref * next = ses.ring.pop();
+			if (!next) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				continue;
+			}
+
+			std::lock_guard<std::mutex> lock(mtx);
+			cur = std::move(*next);
+			ses.ring.release(next);
+			exportCloud(cur, ses);
+
+			ses.timer.add(STAGE_ACQUIRE, cur->grab_ms);
+			ses.timer.add(STAGE_CONVERT, cur->convert_ms);
+			ses.pipe.process(*cur, ses.s);
+			ses.probes.sample(ses.pipe.depth);
+			if (tile.area() > 0) {
+				scoped_timer t(&ses.timer, STAGE_COMPOSE);
+				cv::resize(ses.pipe.ws.out_rgb, tile_rgb, tile, 0, 0, cv::INTER_AREA);
+				cv::resize(ses.pipe.ws.col_depth, tile_depth, tile, 0, 0, cv::INTER_NEAREST);
+			}
+			ses.timer.endFrame();
+			processed++;
+			fps.tick();
+		}
+	}
+
+	cv::Size tile;
+	std::thread worker;
+	std::atomic<bool> running;
+};
+
+typedef std::vector<std::unique_ptr<device_lane>> lanes_t;
+
+std::string laneStatus(device_lane & lane) {
+	session & ses = lane.ses;
+	return ses.tag.substr(1) + ": " + std::to_string((int)lane.fps.fps()) + " fps, " +
+		std::to_string(ses.ring.pushed()) + " frames, " + std::to_string(ses.ring.dropped()) + " dropped" +
+		(lane.cur ? pairingStatus(ses, *lane.cur) : "") + recordingStatus(ses.rec) + pretriggerStatus(ses.pre) + snapshotStatus(ses.snaps) + cloudStatus(ses.clouds);
+}
+
+// Applies a key or command to every device, false on quit.
+bool handleAll(lanes_t & lanes, const std::string & cmd) {
+	bool keep = true;
+	for (auto & lane : lanes) {
+		std::lock_guard<std::mutex> lock(lane->mtx);
+		if (!lane->cur) continue;
+		keep &= handleCommand(cmd, lane->cur, lane->ses);
+	}
+	return keep;
+}
+
+// Every device at once, tiled on one canvas or reported on stdout.
+int runMulti(lanes_t & lanes, bool headless) {
+	cv::Size tile(320, 240);
+#ifdef NO_HIGHGUI
+	headless = true;
+#endif
+	for (auto & lane : lanes) lane->start(headless ? cv::Size() : tile);
+
+	static command_reader commands;
+	if (headless) commands.start();
+
+#ifndef NO_HIGHGUI
+	int n = lanes.size();
+	int per_row = std::min(n, 2);
+	int rows = (n + per_row - 1) / per_row;
+	cv::Mat canvas;
+	if (!headless) {
+		cv::namedWindow("KinectViewer");
+		canvas.create(rows * tile.height + 40, per_row * 2 * tile.width, CV_8UC3);
+		canvas.setTo(cv::Scalar::all(0));
+	}
+#endif
+
+	uint64_t processed_before = 0;
+	auto start = std::chrono::steady_clock::now();
+	auto last_report = start;
+	int result = 0;
+	while (!quit_requested) {
+		bool all_done = true;
+		for (auto & lane : lanes) {
+			if (lane->ses.cap.failed()) result = -1;
+			all_done &= lane->ses.cap.finished() || lane->ses.cap.failed();
+		}
+		if (result < 0 || all_done) break;
+
+		auto now = std::chrono::steady_clock::now();
+		bool report = now - last_report >= std::chrono::seconds(1);
+
+		uint64_t processed = 0;
+		for (auto & lane : lanes) processed += lane->processed;
+
+		if (headless) {
+			std::string cmd;
+			while (commands.poll(cmd)) {
+				if (!handleAll(lanes, cmd)) quit_requested = 1;
+			}
+			if (report) {
+				double secs = std::chrono::duration<double>(now - last_report).count();
+				std::cout << "total: " << (processed - processed_before) / secs << " fps" << std::endl;
+				for (auto & lane : lanes) {
+					std::lock_guard<std::mutex> lock(lane->mtx);
+					std::cout << "  " << laneStatus(*lane) << std::endl;
+					std::cout << probeStatus(lane->ses.probes) << roiStatus(lane->ses.pipe);
+				}
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		}
+#ifndef NO_HIGHGUI
+		else {
+			std::string status;
+			for (int i = 0; i < n; ++i) {
+				device_lane & lane = *lanes[i];
+				cv::Point origin((i % per_row) * 2 * tile.width, (i / per_row) * tile.height);
+				std::lock_guard<std::mutex> lock(lane.mtx);
+				if (lane.tile_rgb.empty()) continue;
+				putOn(canvas, lane.tile_rgb, origin);
+				putOn(canvas, lane.tile_depth, origin + cv::Point(tile.width, 0));
+				cv::putText(canvas, laneStatus(lane).substr(0, 40), origin + cv::Point(6, 16),
+					cv::FONT_HERSHEY_PLAIN, 0.9, cv::Scalar::all(255));
+			}
+			if (report) {
+				double secs = std::chrono::duration<double>(now - last_report).count();
+				status = "devices: " + std::to_string(n) + "   total: " +
+					std::to_string((int)((processed - processed_before) / secs)) + " fps";
+				drawStatus(canvas, status);
+			}
+			cv::imshow("KinectViewer", canvas);
+			int key = cv::waitKey(5);
+			if (key >= 0 && !handleAll(lanes, std::string(1, (char)(key & 0xff)))) break;
+		}
+#endif
+		if (report) {
+			last_report = now;
+			processed_before = processed;
+		}
+	}
+
+	for (auto & lane : lanes) lane->stop();
+
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	uint64_t total = 0;
+	for (auto & lane : lanes) {
+		total += lane->processed;
+		std::cout << lane->ses.tag.substr(1) << ": processed " << lane->processed << " frames" << std::endl;
+	}
+	std::cout << "Processed " << total << " frames in " << elapsed << " s (" << total / elapsed << " fps)" << std::endl;
+	return result;
+}
+
+// Settings shared by every device.
+bool configureSession(const cv::CommandLineParser & parser, session & ses) {
+	ses.s.depth_min = parser.get<int>("min");
+	ses.s.depth_range = parser.get<int>("range");
+	ses.s.blend_ratio = parser.get<int>("blend");
+	if (parser.has("auto")) ses.pipe.tracker.toggle();
+	ses.rec.compress_depth = parser.get<cv::String>("record-depth") != "raw";
+	ses.snaps.depth_kvd = parser.get<cv::String>("save-depth") == "kvd";
+
+	double pre_seconds = parser.get<double>("pretrigger");
+	if (pre_seconds > 0) {
+		pretrigger & pre = ses.pre;
+		pre.seconds = pre_seconds;
+		pre.post_seconds = parser.get<double>("posttrigger");
+		pre.compress = parser.has("pretrigger-compress");
+		pre.compress_depth = ses.rec.compress_depth;
+		if (!pre.start((size_t)parser.get<int>("pretrigger-mb") << 20)) return false;
+		ses.cap.bufferTo(&pre);
+	}
+
+	depth_filter & filter = ses.pipe.filter;
+	cv::String filter_mode = parser.get<cv::String>("filter");
+	for (int m = 0; m < depth_filter::MODE_COUNT; ++m) {
+		if (filter_mode == depth_filter::name(m)) filter.mode = m;
+	}
+	filter.alpha = parser.get<double>("filter-alpha");
+	filter.jump = parser.get<int>("filter-jump");
+
+	hole_fill & fill = ses.pipe.fill;
+	cv::String fill_mode = parser.get<cv::String>("fill");
+	for (int m = 0; m < hole_fill::MODE_COUNT; ++m) {
+		if (fill_mode == hole_fill::name(m)) fill.mode = m;
+	}
+	cv::String fill_views = parser.get<cv::String>("fill-views");
+	if (fill_views == "depth") ses.pipe.fill_views = pipeline::FILL_DEPTH;
+	else if (fill_views == "rgb") ses.pipe.fill_views = pipeline::FILL_BLEND;
+	fill.max_gap = parser.get<int>("fill-gap");
+
+	for (const std::string & roi : split(parser.get<cv::String>("roi"), ';')) {
+		auto v = split(roi, ',');
+		if (v.size() != 4) {
+			std::cerr << "ROI must be x,y,w,h: " << roi << std::endl;
+			return false;
+		}
+		ses.pipe.rois.push_back(cv::Rect(std::stoi(v[0]), std::stoi(v[1]), std::stoi(v[2]), std::stoi(v[3])));
+	}
+
+	ses.probes.setLength(std::max(parser.get<int>("history"), 1));
+	for (const std::string & probe : split(parser.get<cv::String>("probe"), ';')) {
+		auto name_pos = split(probe, ':');
+		auto v = split(name_pos.back(), ',');
+		if (name_pos.size() > 2 || v.size() != 2) {
+			std::cerr << "Probe must be name:x,y or x,y: " << probe << std::endl;
+			return false;
+		}
+		ses.probes.add(name_pos.size() == 2 ? name_pos[0] : "", cv::Point(std::stoi(v[0]), std::stoi(v[1])));
+	}
+
+	cv::String cloud_dir = parser.get<cv::String>("cloud");
+	ses.clouds.dir = cloud_dir.empty() ? "." : cloud_dir;
+	ses.clouds.continuous = !cloud_dir.empty();
+	cv::String intr = parser.get<cv::String>("intrinsics");
+	if (!intr.empty()) {
+		auto v = split(intr, ',');
+		if (v.size() != 4) {
+			std::cerr << "Intrinsics must be fx,fy,cx,cy: " << intr << std::endl;
+			return false;
+		}
+		intrinsics k;
+		k.fx = std::stof(v[0]);
+		k.fy = std::stof(v[1]);
+		k.cx = std::stof(v[2]);
+		k.cy = std::stof(v[3]);
+		ses.clouds.setIntrinsics(k);
+	}
+
+	cv::String timing_path = parser.get<cv::String>("timing-csv");
+	if (!timing_path.empty() && !ses.timer.openCsv(taggedPath(timing_path, ses.tag))) {
+		return false;
+	}
+	return true;
+
+}
+
+// Frame source for device index (or whatever replaces the device).
+bool openSource(const cv::CommandLineParser & parser, session & ses, int index) {
+	cv::String play_path = parser.get<cv::String>("play");
+	cv::String play_mode = parser.get<cv::String>("play-mode");
+	cv::String img1 = parser.get<cv::String>(0);
+	cv::String img2 = parser.get<cv::String>(1);
+
+	if (!play_path.empty()) {
+		ses.player = new playback;
+		ses.setSource(ses.player);
+		if (!ses.player->open(play_path)) return false;
+		if (play_mode == "fast") ses.player->setMode(playback::FAST);
+		else if (play_mode == "paused") ses.player->setMode(playback::PAUSED);
+		ses.player->loop = parser.has("loop");
+	} else if (parser.has("synthetic")) {
+		synthetic_config cfg;
+		cfg.width = parser.get<int>("synth-width");
+		cfg.height = parser.get<int>("synth-height");
+		cfg.fps = parser.get<double>("synth-fps");
+		cfg.planes = parser.get<int>("synth-planes");
+		cfg.spheres = parser.get<int>("synth-spheres");
+		cfg.noise = parser.get<double>("synth-noise");
+		cfg.holes = parser.get<double>("synth-holes");
+		cfg.seed += index;
+		ses.setSource(new synthetic_source(cfg));
+	} else if (!img1.empty() && !img2.empty()) {
+		std::cout << "Reading images" << std::endl;
+		cv::Mat sim_rgb = cv::imread(img1);
+		if (sim_rgb.empty()) {
+			std::cerr << "Can't read rgb image: " << img1 << std::endl;
+			return false;
+		}
+
+		cv::Mat sim_depth;
+		if (img2.size() > 4 && img2.substr(img2.size() - 4) == ".kvd") readDepthFile(img2, sim_depth);
+		else sim_depth = cv::imread(img2, -1);
+		if (sim_depth.empty()) {
+			std::cerr << "Can't read depth image: " << img2 << std::endl;
+			return false;
+		}
+		ses.setSource(new image_source(sim_rgb, sim_depth));
+	} else {
+		ses.device = new freenect_source(index);
+		ses.setSource(ses.device);
+		cv::String curve = parser.get<cv::String>("ir-curve");
+		for (int c = 0; c < ir_tone::CURVE_COUNT; ++c) {
+			if (curve == ir_tone::name(c)) ses.device->ir_curve = c;
+		}
+		ses.device->ir_gamma = parser.get<double>("ir-gamma");
+		ses.device->pairing.max_skew_ms = parser.get<double>("pair-skew");
+		ses.device->pairing.drop_skewed = parser.has("pair-drop");
+	}
+	return true;
+}
+
+int main(int argc, char * argv[]) {
+	installAllocCounter();
+
+
+	const cv::String keys =
+		"{help h usage ? |      | print this message   }"
+		"{@rgb           |      | rgb image            }"
+		"{@depth         |      | depth image, .png or .kvd }"
+		"{device         |0     | device id            }"
+		"{devices        |      | comma separated device ids, each with its own capture and processing thread }"
+		"{headless       |      | no window, commands are read from stdin }"
+		"{min            |500   | depth range start [mm] }"
+		"{range          |1500  | depth range width [mm] }"
+		"{blend          |50    | rgb blend ratio [%]  }"
+		"{auto           |      | continuous auto range }"
+		"{record         |      | record the session to this .kvr file }"
+		"{record-depth   |kvd   | recorded depth: kvd (lossless compressed) or raw }"
+		"{save-depth     |png   | saved depth images: png or kvd (lossless compressed) }"
+		"{pretrigger     |0     | keep the last seconds of frames in RAM, T saves them }"
+		"{pretrigger-mb  |1024  | memory for the pre-trigger buffer [MB] }"
+		"{pretrigger-compress | | compress buffered frames (RGB as JPEG) to fit more }"
+		"{posttrigger    |5     | seconds after the trigger saved with the clip }"
+		"{play           |      | play back a .kvr recording instead of the device }"
+		"{play-mode      |realtime | realtime, fast (every frame, as fast as processed) or paused }"
+		"{loop           |      | loop playback }"
+		"{ir-curve       |quadratic | IR tone curve: quadratic, linear or gamma }"
+		"{ir-gamma       |2.2   | gamma for the gamma IR tone curve }"
+		"{pair-skew      |10    | largest RGB/depth timestamp difference of a pair [ms] }"
+		"{pair-drop      |      | drop RGB/depth pairs over pair-skew instead of flagging them }"
+		"{cloud          |      | export a PLY point cloud of every frame to this directory }"
+		"{intrinsics     |      | depth camera fx,fy,cx,cy for point clouds [px] }"
+		"{filter         |off   | temporal depth filter: off, ema or median }"
+		"{filter-alpha   |0.3   | EMA weight of a new depth sample }"
+		"{filter-jump    |100   | depth change that restarts a filtered pixel [mm] }"
+		"{fill           |off   | hole filling: off, guided or push-pull }"
+		"{fill-views     |both  | views showing filled depth: depth, rgb or both }"
+		"{fill-gap       |32    | largest hole that gets filled [px] }"
+		"{roi            |      | ROIs as x,y,w,h in frame pixels, several separated by ; }"
+		"{probe          |      | depth probes as name:x,y in frame pixels, several separated by ; }"
+		"{history        |800   | samples kept per probe trace }"
+		"{timing-csv     |      | log per-frame stage timings to this CSV file }"
+		"{synthetic      |      | generate frames procedurally instead of the device }"
+		"{synth-width    |640   | synthetic frame width }"
+		"{synth-height   |480   | synthetic frame height }"
+		"{synth-fps      |30    | synthetic frame rate, 0 = as fast as processed, none dropped }"
+		"{synth-planes   |2     | synthetic background planes }"
+		"{synth-spheres  |3     | synthetic moving spheres }"
+		"{synth-noise    |4     | synthetic depth noise sigma [mm] }"
+		"{synth-holes    |0.02  | synthetic fraction of invalid pixels }"
+        ;
+
+	cv::CommandLineParser parser(argc, argv, keys);
+	parser.about("KinectViewer v0.0.1");
+	if (parser.has("help"))
+	{
+	    parser.printMessage();
+	    return 0;
+	}
+	int index = parser.get<int>("device");
+	bool headless = parser.has("headless");
+	cv::String record_path = parser.get<cv::String>("record");
+	cv::String play_path = parser.get<cv::String>("play");
+	cv::String device_list = parser.get<cv::String>("devices");
+	if (!parser.check())
+	{
+	    parser.printErrors();
+	    return 0;
+	}
+
+	std::signal(SIGINT, onSignal);
+	std::signal(SIGTERM, onSignal);
+
+	if (!device_list.empty()) {
+		if (!play_path.empty()) {
+			std::cerr << "Playback is single device only" << std::endl;
+			return -1;
+		}
+		std::vector<std::unique_ptr<device_lane>> lanes;
+		for (const std::string & id : split(device_list, ',')) {
+			lanes.emplace_back(new device_lane);
+			session & lane_ses = lanes.back()->ses;
+			lane_ses.tag = "_dev" + strip(id);
+			if (!configureSession(parser, lane_ses) || !openSource(parser, lane_ses, std::stoi(id))) return -1;
+			if (!record_path.empty() && !lane_ses.rec.start(taggedPath(record_path, lane_ses.tag))) return -1;
+		}
+		return runMulti(lanes, headless);
+	}
+
+	session ses;
+	if (!configureSession(parser, ses) || !openSource(parser, ses, index)) return -1;
+
+	if (!record_path.empty() && !ses.rec.start(record_path)) {
+		return -1;
+	}
+
+	ses.cap.start();
+
+#ifndef NO_HIGHGUI
+	if (!headless) return runGui(ses);
+#endif
+	return runHeadless(ses);
+}
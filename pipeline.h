@@ -0,0 +1,118 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <opencv2/opencv.hpp>
+
+#include <vector>
+
+#include "frame.h"
+#include "depth_filter.h"
+#include "hole_fill.h"
+#include "depth_colorizer.h"
+#include "depth_hist.h"
+#include "auto_range.h"
+#include "blend.h"
+#include "roi_stats.h"
+#include "frame_workspace.h"
+#include "stage_timer.h"
+
+// Controls shared by the trackbars, the command line and stdin.
+struct settings {
+	settings() : depth_min(500), depth_range(1500), blend_ratio(50) {}
+
+	int depth_min;
+	int depth_range;
+	int blend_ratio;
+};
+
+// Per-frame processing, independent of how (or whether) the result is shown.
+class pipeline {
+public:
+	// views that show hole filled depth, so filled and raw can be compared
+	enum fill_view { FILL_DEPTH = 1, FILL_BLEND = 2, FILL_BOTH = 3 };
+
+	pipeline() : timer(nullptr), fill_views(FILL_BOTH), range_changed(false) {}
+
+	// fresh is false when the same frame is processed again (e.g. GUI redraw
+	// without a new frame), so the range tracker sees every frame only once.
+	void process(const frame & f, settings & s, bool fresh = true) {
+		ws.reserve(f.depth.size());
+
+		if (filter.mode == depth_filter::OFF) {
+			depth = f.depth;
+		} else {
+			scoped_timer t(timer, STAGE_FILTER);
+			filter.apply(f.depth, ws.filtered_depth, fresh);
+			depth = ws.filtered_depth;
+		}
+
+		// statistics always see the unfilled depth
+		cv::Mat filled = depth;
+		if (fill.mode != hole_fill::OFF) {
+			scoped_timer t(timer, STAGE_FILL);
+			fill.apply(depth, f.rgb, ws.filled_depth);
+			filled = ws.filled_depth;
+		}
+
+		{
+			scoped_timer t(timer, STAGE_COLORIZE);
+			range_changed = colorizer.update(s.depth_min, s.depth_range);
+			colorizer.apply(fill_views & FILL_DEPTH ? filled : depth, ws.col_depth);
+		}
+
+		{
+			scoped_timer t(timer, STAGE_BLEND);
+			maskBlend(fill_views & FILL_BLEND ? filled : depth, f.rgb, ws.out_rgb, s.depth_min, s.depth_range, s.blend_ratio);
+		}
+
+		{
+			scoped_timer t(timer, STAGE_HISTOGRAM);
+			hist.compute(depth);
+			if (fresh && tracker.update(hist)) {
+				s.depth_min = tracker.min();
+				s.depth_range = tracker.range();
+			}
+		}
+
+		if (!rois.empty()) {
+			scoped_timer t(timer, STAGE_ROI);
+			roi.build(depth, f.rgb);
+			roi_results.resize(rois.size());
+			for (size_t i = 0; i < rois.size(); ++i) roi_results[i] = roi.query(rois[i]);
+		}
+	}
+
+	// One-shot auto range from the last processed frame.
+	void autoRange(settings & s) const {
+		if (hist.total() == 0) return;
+		s.depth_min = hist.percentile(0.001);
+		s.depth_range = hist.percentile(0.999) - s.depth_min;
+	}
+
+	// optional, stages are timed when set
+	frame_timer * timer;
+
+	depth_filter filter;
+	hole_fill fill;
+	int fill_views;
+	depth_colorizer colorizer;
+	depth_hist hist;
+	auto_range tracker;
+
+	// ROIs in frame pixels, roi_results[i] is for rois[i]
+	roi_stats roi;
+	std::vector<cv::Rect> rois;
+	std::vector<roi_result> roi_results;
+
+	// all per-frame buffers, results in ws.col_depth and ws.out_rgb
+	frame_workspace ws;
+
+	// depth the last process() call worked on: the frame's own or the
+	// filtered one, valid while that frame is held
+	cv::Mat depth;
+
+	// colorizer table was rebuilt by the last process() call
+	bool range_changed;
+};
+
+#endif
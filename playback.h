@@ -0,0 +1,265 @@
+#ifndef PLAYBACK_H
+#define PLAYBACK_H
+
+#include <opencv2/opencv.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "frame.h"
+#include "frame_source.h"
+#include "recording.h"
+
+// Plays back a .kvr recording straight from a memory mapping. Frames handed
+// out are cv::Mat views into the read-only mapping, nothing is copied, except
+// that compressed depth is decoded into the frame's own buffer. Frames are
+// read-only downstream like every pooled frame. Chunks are checked once when
+// the file is indexed, and frames whose planes don't fit their chunk or the
+// header's frame size are skipped.
+class playback : public frame_source {
+public:
+	enum mode {
+		REALTIME,  // paced by the recorded wall-clock times
+		FAST,      // as fast as the consumer takes frames, none dropped
+		PAUSED     // only moves on seek()/step()
+	};
+
+	playback() :
+		loop(false), base(nullptr), length(0), width(0), height(0), rgb_type(0), depth_type(0),
+		depth_format(0), play_mode(REALTIME), resume_mode(REALTIME), pos(0), shown(0), seek_to(-1), anchored(false)
+	{
+	}
+
+	~playback() {
+		close();
+	}
+
+	bool open(const std::string & path) {
+		close();
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			std::cerr << "Can't open recording: " << path << std::endl;
+			return false;
+		}
+		struct stat st;
+		if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(rec_header)) {
+			std::cerr << "Not a recording: " << path << std::endl;
+			::close(fd);
+			return false;
+		}
+		length = st.st_size;
+		void * p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (p == MAP_FAILED) {
+			std::cerr << "Can't map recording: " << path << std::endl;
+			length = 0;
+			return false;
+		}
+		base = (uint8_t *)p;
+		madvise(base, length, MADV_SEQUENTIAL);
+
+		const rec_header * h = (const rec_header *)base;
+		if (std::memcmp(h->magic, REC_MAGIC, sizeof(REC_MAGIC)) != 0 || h->version != REC_VERSION) {
+			std::cerr << "Not a recording: " << path << std::endl;
+			close();
+			return false;
+		}
+		width = h->width;
+		height = h->height;
+		rgb_type = h->rgb_type;
+		depth_type = h->depth_type;
+		depth_format = h->depth_format;
+		if (depth_format != REC_DEPTH_RAW && depth_format != REC_DEPTH_KVD) {
+			std::cerr << "Unknown depth format in recording: " << path << std::endl;
+			close();
+			return false;
+		}
+		if (width <= 0 || height <= 0 || (uint64_t)width * height > KVD_MAX_PIXELS ||
+				rgb_type != CV_8UC3 || depth_type != CV_16UC1) {
+			std::cerr << "Bad frame format in recording: " << path << std::endl;
+			close();
+			return false;
+		}
+
+		// index the frame chunks, a truncated last chunk is ignored
+		size_t off = sizeof(rec_header);
+		size_t skipped = 0;
+		while (off + 8 <= length) {
+			uint32_t size;
+			std::memcpy(&size, base + off + 4, sizeof(size));
+			if (size > length - off - 8) break;
+			if (std::memcmp(base + off, "FRME", 4) == 0) {
+				if (validFrame(off, size)) offsets.push_back(off);
+				else skipped++;
+			}
+			off += 8 + size;
+		}
+		if (skipped) std::cerr << "Skipped " << skipped << " bad frames in recording: " << path << std::endl;
+		if (offsets.empty()) {
+			std::cerr << "No frames in recording: " << path << std::endl;
+			close();
+			return false;
+		}
+		// first frame goes out even when starting paused
+		pos = 0;
+		seek_to = 0;
+		return true;
+	}
+
+	void close() {
+		if (base) munmap(base, length);
+		base = nullptr;
+		length = 0;
+		offsets.clear();
+	}
+
+	size_t size() const { return offsets.size(); }
+	// index of the frame handed out last
+	size_t position() const { return shown; }
+
+	// Zero-copy view of frame i, false when its depth doesn't decode.
+	bool view(size_t i, frame & f) const {
+		const rec_frame * r = (const rec_frame *)(base + offsets[i]);
+		uint8_t * rgb = base + offsets[i] + sizeof(rec_frame);
+		uint8_t * depth = rgb + recPadded(r->rgb_bytes);
+		f.rgb = cv::Mat(height, width, rgb_type, rgb);
+		bool ok = true;
+		if (depth_format == REC_DEPTH_KVD) {
+			ok = depth_codec::decode(depth, r->depth_bytes, f.depth, cv::Size(width, height));
+			if (!ok) {
+				f.depth.create(height, width, CV_16UC1);
+				f.depth.setTo(cv::Scalar::all(0));
+			}
+		} else {
+			f.depth = cv::Mat(height, width, depth_type, depth);
+		}
+		f.depth_ts = r->depth_ts;
+		f.rgb_ts = r->rgb_ts;
+		f.seq = r->seq;
+		f.time = std::chrono::system_clock::time_point(
+			std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::microseconds(r->time_us)));
+		return ok;
+	}
+
+	// Called by the acquisition thread. Waits as long as the mode requires
+	// (at most a few ms when paused, so the caller can still be stopped).
+	result grab(frame & f) {
+		long target = seek_to.exchange(-1);
+		if (target >= 0) {
+			pos = std::min<size_t>(target, offsets.size() - 1);
+			anchored = false;
+		} else if (play_mode == PAUSED) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			return IDLE;
+		}
+
+		if (pos >= offsets.size()) {
+			if (!loop) return END;
+			pos = 0;
+			anchored = false;
+		}
+
+		if (play_mode == REALTIME && target < 0 && !pace(pos)) return IDLE;
+		if (!view(pos, f)) std::cerr << "Corrupt depth in frame " << pos << std::endl;
+		shown = pos;
+		if (play_mode != PAUSED) pos++;
+		return FRAME;
+	}
+
+	bool lossless() const { return play_mode == FAST; }
+
+	// thread-safe controls
+
+	void setMode(mode m) {
+		play_mode = m;
+		anchored = false;
+	}
+
+	void togglePause() {
+		if (play_mode == PAUSED) {
+			setMode(resume_mode);
+		} else {
+			resume_mode = play_mode;
+			setMode(PAUSED);
+		}
+	}
+
+	void seek(long i) {
+		seek_to = std::max(0L, i);
+	}
+
+	// Relative seek, pauses playback so single steps can be inspected.
+	void step(int delta) {
+		if (play_mode != PAUSED) togglePause();
+		seek((long)shown + delta);
+	}
+
+	bool loop;
+
+private:
+	// The chunk at off, size bytes after its tag and size, holds both planes
+	// and they have the header's frame size.
+	bool validFrame(size_t off, uint32_t size) const {
+		if (size < sizeof(rec_frame) - 8) return false;
+		const rec_frame * r = (const rec_frame *)(base + off);
+		uint64_t pixels = (uint64_t)width * height;
+		if (r->rgb_bytes != pixels * 3) return false;
+		if (depth_format == REC_DEPTH_RAW ? r->depth_bytes != pixels * 2 : r->depth_bytes < KVD_HEADER) return false;
+		return sizeof(rec_frame) - 8 + recPadded(r->rgb_bytes) + recPadded(r->depth_bytes) <= (uint64_t)size;
+	}
+
+	// Sleeps towards frame i's time, a slice at a time so grab() keeps
+	// returning; false while it isn't due yet. Jumps in the recorded clock
+	// (a clock step, a stalled device) re-anchor instead of being waited out.
+	bool pace(size_t i) {
+		static const auto SLICE = std::chrono::milliseconds(20);
+		static const auto MAX_GAP = std::chrono::seconds(2);
+		const rec_frame * r = (const rec_frame *)(base + offsets[i]);
+		auto now = std::chrono::steady_clock::now();
+		auto due = now;
+		if (anchored) due = anchor_wall + std::chrono::microseconds(r->time_us - anchor_us);
+		if (!anchored || due > now + MAX_GAP || due < now - MAX_GAP) {
+			anchor_wall = now;
+			anchor_us = r->time_us;
+			anchored = true;
+			return true;
+		}
+		if (due <= now) return true;
+		if (due > now + SLICE) {
+			std::this_thread::sleep_for(SLICE);
+			return false;
+		}
+		std::this_thread::sleep_until(due);
+		return true;
+	}
+
+	uint8_t * base;
+	size_t length;
+	std::vector<size_t> offsets;
+
+	int width, height;
+	int rgb_type, depth_type;
+	uint32_t depth_format;
+
+	std::atomic<mode> play_mode;
+	mode resume_mode;
+	size_t pos;
+	std::atomic<size_t> shown;
+	std::atomic<long> seek_to;
+
+	std::atomic<bool> anchored;
+	std::chrono::steady_clock::time_point anchor_wall;
+	int64_t anchor_us;
+};
+
+#endif
@@ -0,0 +1,232 @@
+#ifndef POINT_CLOUD_H
+#define POINT_CLOUD_H
+
+#include <opencv2/opencv.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "frame.h"
+#include "frame_pool.h"
+#include "job_queue.h"
+
+// Pinhole intrinsics of the camera the depth image is registered to.
+// Defaults are the Kinect v1 RGB camera, which is what
+// FREENECT_DEPTH_REGISTERED maps depth onto.
+struct intrinsics {
+	intrinsics() : fx(594.21f), fy(591.04f), cx(339.5f), cy(242.7f) {}
+
+	bool operator==(const intrinsics & o) const {
+		return fx == o.fx && fy == o.fy && cx == o.cx && cy == o.cy;
+	}
+
+	float fx, fy, cx, cy;
+};
+
+// Depth (uint16 mm) back-projected to camera space in metres: x right,
+// y down, z forward. Stored as planes, one float per pixel, with z = 0 where
+// depth is invalid.
+//
+// A pinhole ray only depends on the column for x and on the row for y, so
+// the ray tables are one float per column and one per row, and the inner
+// loop is two multiplies per pixel.
+class point_cloud {
+public:
+	point_cloud() : rays_for(0, 0) {}
+
+	void project(const cv::Mat & depth, const intrinsics & k) {
+		if (depth.size() != rays_for || !(k == rays_k)) buildRays(depth.size(), k);
+		size_t n = depth.total();
+		xs.resize(n);
+		ys.resize(n);
+		zs.resize(n);
+		for (int y = 0; y < depth.rows; ++y) {
+			size_t o = (size_t)y * depth.cols;
+			projectRow(depth.ptr<uint16_t>(y), &ray_x[0], ray_y[y], &xs[o], &ys[o], &zs[o], depth.cols);
+		}
+		cols = depth.cols;
+		rows = depth.rows;
+	}
+
+	size_t size() const { return zs.size(); }
+	int width() const { return cols; }
+	int height() const { return rows; }
+
+	std::vector<float> xs, ys, zs;
+
+private:
+	void buildRays(cv::Size size, const intrinsics & k) {
+		ray_x.resize(size.width);
+		ray_y.resize(size.height);
+		for (int u = 0; u < size.width; ++u) ray_x[u] = (u - k.cx) / k.fx;
+		for (int v = 0; v < size.height; ++v) ray_y[v] = (v - k.cy) / k.fy;
+		rays_for = size;
+		rays_k = k;
+	}
+
+	static void projectRow(const uint16_t * depth, const float * rx, float ry,
+			float * x, float * y, float * z, int n) {
+		int i = 0;
+#ifdef __SSE2__
+		__m128i zero = _mm_setzero_si128();
+		__m128 scale = _mm_set1_ps(0.001f);
+		__m128 vry = _mm_set1_ps(ry);
+		for (; i + 8 <= n; i += 8) {
+			__m128i d = _mm_loadu_si128((const __m128i *)(depth + i));
+			__m128 z0 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(d, zero)), scale);
+			__m128 z1 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(d, zero)), scale);
+			_mm_storeu_ps(z + i, z0);
+			_mm_storeu_ps(z + i + 4, z1);
+			_mm_storeu_ps(x + i, _mm_mul_ps(z0, _mm_loadu_ps(rx + i)));
+			_mm_storeu_ps(x + i + 4, _mm_mul_ps(z1, _mm_loadu_ps(rx + i + 4)));
+			_mm_storeu_ps(y + i, _mm_mul_ps(z0, vry));
+			_mm_storeu_ps(y + i + 4, _mm_mul_ps(z1, vry));
+		}
+#endif
+		for (; i < n; ++i) {
+			float d = depth[i] * 0.001f;
+			z[i] = d;
+			x[i] = d * rx[i];
+			y[i] = d * ry;
+		}
+	}
+
+	std::vector<float> ray_x, ray_y;
+	cv::Size rays_for;
+	intrinsics rays_k;
+	int cols, rows;
+};
+
+// Background PLY export. save() queues a reference to the frame and returns,
+// the writer thread back-projects it and writes a binary little-endian PLY
+// (float x y z, uchar red green blue) of the valid points. When the disk
+// can't keep up the frame is dropped and counted, like the recorder does.
+class cloud_writer {
+public:
+	explicit cloud_writer(size_t slots = 4) :
+		continuous(false), written_cnt(0), last_points(0), last_ms(0)
+	{
+		jobs.start(slots, 1, [this](job & j) { run(j); });
+	}
+
+	~cloud_writer() {
+		jobs.stop();
+	}
+
+	void setIntrinsics(const intrinsics & k) {
+		std::lock_guard<std::mutex> lock(mtx);
+		cam = k;
+	}
+
+	bool save(const frame_ref & f, const std::string & path) {
+		job j;
+		j.f = f;
+		j.path = path;
+		return jobs.push(j);
+	}
+
+	// every frame is exported to this directory while continuous is set
+	std::string dir;
+	std::atomic<bool> continuous;
+
+	uint64_t written() const { return written_cnt; }
+	uint64_t dropped() const { return jobs.dropped(); }
+	size_t lastPoints() const { return last_points; }
+	float lastMs() const { return last_ms; }
+
+	size_t queued() { return jobs.queued(); }
+
+private:
+	struct job {
+		frame_ref f;
+		std::string path;
+	};
+
+	void run(job & j) {
+		intrinsics k;
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			k = cam;
+		}
+		auto start = std::chrono::steady_clock::now();
+		if (writePly(*j.f, k, j.path)) written_cnt++;
+		last_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	bool writePly(const frame & f, const intrinsics & k, const std::string & path) {
+		cloud.project(f.depth, k);
+
+		// colors only when RGB is registered to the depth image
+		bool color = f.rgb.size() == f.depth.size() && f.rgb.type() == CV_8UC3;
+		static const size_t POINT_BYTES = 3 * sizeof(float) + 3;
+		packed.resize(cloud.size() * POINT_BYTES);
+		char * p = &packed[0];
+		size_t points = 0;
+		for (int y = 0; y < cloud.height(); ++y) {
+			const cv::Vec3b * bgr = color ? f.rgb.ptr<cv::Vec3b>(y) : nullptr;
+			size_t o = (size_t)y * cloud.width();
+			for (int x = 0; x < cloud.width(); ++x) {
+				if (cloud.zs[o + x] == 0) continue;
+				float xyz[3] = { cloud.xs[o + x], cloud.ys[o + x], cloud.zs[o + x] };
+				std::memcpy(p, xyz, sizeof(xyz));
+				p[12] = color ? bgr[x][2] : 255;
+				p[13] = color ? bgr[x][1] : 255;
+				p[14] = color ? bgr[x][0] : 255;
+				p += POINT_BYTES;
+				points++;
+			}
+		}
+
+		std::FILE * file = std::fopen(path.c_str(), "wb");
+		if (!file) {
+			std::cerr << "Can't write point cloud: " << path << std::endl;
+			return false;
+		}
+		std::fprintf(file,
+			"ply\n"
+			"format binary_little_endian 1.0\n"
+			"element vertex %zu\n"
+			"property float x\n"
+			"property float y\n"
+			"property float z\n"
+			"property uchar red\n"
+			"property uchar green\n"
+			"property uchar blue\n"
+			"end_header\n", points);
+		bool ok = !std::ferror(file) && (!points || std::fwrite(&packed[0], POINT_BYTES, points, file) == points);
+		if (std::fclose(file) != 0) ok = false;
+		if (!ok) {
+			std::cerr << "Can't write point cloud: " << path << std::endl;
+			return false;
+		}
+		last_points = points;
+		return true;
+	}
+
+	std::mutex mtx;
+	intrinsics cam;
+
+	// writer thread only
+	point_cloud cloud;
+	std::vector<char> packed;
+
+	std::atomic<uint64_t> written_cnt;
+	std::atomic<size_t> last_points;
+	std::atomic<float> last_ms;
+
+	// last, so the writer stops before the rest goes
+	job_queue<job> jobs;
+};
+
+#endif
@@ -0,0 +1,343 @@
+#ifndef PRETRIGGER_H
+#define PRETRIGGER_H
+
+#include <opencv2/opencv.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "depth_codec.h"
+#include "frame.h"
+#include "frame_pool.h"
+#include "recording.h"
+#include "job_queue.h"
+
+// The last seconds of frames kept in RAM, so a trigger can save what led up
+// to it.
+//
+// Frames are copied, or with compress encoded (depth with depth_codec,
+// lossless, RGB as JPEG), into one arena allocated up front and used as a
+// circular log: the oldest frames make room for new ones, and frames older
+// than seconds go as well, so memory never exceeds the budget. push() only
+// queues a frame reference for the buffer thread. trigger() only marks the
+// clip, a flush thread writes it to a .kvr recording, up to post_seconds past
+// the trigger, while frames keep coming in. Frames the flush hasn't written
+// are never overwritten; when they fill the arena new frames are dropped and
+// counted instead.
+class pretrigger {
+public:
+	// slots is how many frames may wait for the buffer thread
+	explicit pretrigger(size_t slots = 8) :
+		seconds(10), post_seconds(5), compress(false), compress_depth(true),
+		nslots(slots), arena_size(0), head(0), first(0), next(0), stored(0),
+		flushing(false), flush_from(0), active(false), dropped_cnt(0), saved_cnt(0)
+	{
+	}
+
+	~pretrigger() {
+		stop();
+	}
+
+	// Allocates budget bytes and starts buffering. max_frames bounds the
+	// frame count independently of their size.
+	bool start(size_t budget, size_t max_frames = 4096) {
+		stop();
+		arena.reset(new (std::nothrow) uint8_t[budget]);
+		if (!arena) {
+			std::cerr << "Can't allocate " << (budget >> 20) << " MB for the pre-trigger buffer" << std::endl;
+			return false;
+		}
+		arena_size = budget;
+		entries.assign(max_frames, entry());
+		head = first = next = 0;
+		stored = 0;
+		flushing = false;
+		dropped_cnt = 0;
+
+		active = true;
+		incoming.start(nslots, 1, [this](frame_ref & f) { store(*f); });
+		flush_thread = std::thread(&pretrigger::flush, this);
+		return true;
+	}
+
+	// Stops buffering; a clip being saved is cut short.
+	void stop() {
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			if (!active) return;
+			active = false;
+		}
+		wake.notify_all();
+		incoming.stop();
+		flush_thread.join();
+		arena.reset();
+	}
+
+	bool enabled() const { return active; }
+
+	// Called from the acquisition thread for every frame, never blocks.
+	void push(const frame_ref & f) {
+		incoming.push(f);
+	}
+
+	// Saves everything buffered plus post_seconds after the newest frame to
+	// path. False when there's nothing to save or a clip is still being saved.
+	bool trigger(const std::string & path) {
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			if (!active || flushing || first == next) return false;
+			flushing = true;
+			flush_from = first;
+			flush_until = at(next - 1).time + toDuration(post_seconds);
+			flush_deadline = std::chrono::steady_clock::now() + toDuration(post_seconds + 2);
+			clip_path = path;
+			saved_cnt = 0;
+		}
+		wake.notify_all();
+		return true;
+	}
+
+	size_t frames() {
+		std::lock_guard<std::mutex> lock(mtx);
+		return next - first;
+	}
+
+	// time between the oldest and the newest frame
+	double span() {
+		std::lock_guard<std::mutex> lock(mtx);
+		if (first == next) return 0;
+		return std::chrono::duration<double>(at(next - 1).time - at(first).time).count();
+	}
+
+	size_t usedBytes() {
+		std::lock_guard<std::mutex> lock(mtx);
+		return stored;
+	}
+
+	size_t budget() const { return arena_size; }
+	bool saving() const { return flushing; }
+	uint64_t saved() const { return saved_cnt; }
+	uint64_t dropped() const { return dropped_cnt + incoming.dropped(); }
+
+	// set before start()
+	double seconds;
+	double post_seconds;
+	bool compress;        // encode frames in RAM, RGB becomes lossy
+	bool compress_depth;  // depth_codec in saved clips
+
+private:
+	struct entry {
+		size_t offset, rgb_bytes, depth_bytes;
+		int rows, cols, rgb_type;  // of the RGB plane; depth is CV_16UC1
+		int depth_rows, depth_cols;
+		bool encoded;
+		uint64_t seq;
+		uint32_t rgb_ts, depth_ts;
+		std::chrono::system_clock::time_point time;
+	};
+
+	static std::chrono::system_clock::duration toDuration(double s) {
+		return std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::duration<double>(s));
+	}
+
+	// frame id to entry, ids count up from 0 and live in [first, next)
+	entry & at(uint64_t id) { return entries[id % entries.size()]; }
+
+	// Lets the oldest frame go unless the flush still has to write it.
+	bool evict() {
+		if (first == next || (flushing && first >= flush_from)) return false;
+		stored -= at(first).rgb_bytes + at(first).depth_bytes;
+		first++;
+		return true;
+	}
+
+	// Arena offset for need bytes, evicting as needed. The live frames
+	// occupy [tail, head), or [tail, end of the last lap) and [0, head)
+	// once writing wrapped around.
+	bool reserve(size_t need, size_t & offset) {
+		for (;;) {
+			if (first == next) {
+				head = 0;
+				if (need > arena_size) return false;
+				offset = 0;
+				return true;
+			}
+			if (next - first < entries.size()) {
+				size_t tail = at(first).offset;
+				if (tail < head) {
+					if (need <= arena_size - head) {
+						offset = head;
+						return true;
+					}
+					if (need <= tail) {
+						offset = 0;
+						return true;
+					}
+				} else if (need <= tail - head) {
+					offset = head;
+					return true;
+				}
+			}
+			if (!evict()) return false;
+		}
+	}
+
+	void store(const frame & f) {
+		CV_Assert(f.rgb.type() == CV_8UC3 && f.depth.type() == CV_16UC1);
+		entry e;
+		e.rows = f.rgb.rows;
+		e.cols = f.rgb.cols;
+		e.rgb_type = f.rgb.type();
+		e.depth_rows = f.depth.rows;
+		e.depth_cols = f.depth.cols;
+		e.encoded = compress;
+		e.seq = f.seq;
+		e.rgb_ts = f.rgb_ts;
+		e.depth_ts = f.depth_ts;
+		e.time = f.time;
+		if (compress) {
+			static const std::vector<int> jpeg = { cv::IMWRITE_JPEG_QUALITY, 90 };
+			cv::imencode(".jpg", f.rgb, rgb_buf, jpeg);
+			depth_codec::encode(f.depth, depth_buf);
+			e.rgb_bytes = rgb_buf.size();
+			e.depth_bytes = depth_buf.size();
+		} else {
+			e.rgb_bytes = f.rgb.total() * f.rgb.elemSize();
+			e.depth_bytes = f.depth.total() * f.depth.elemSize();
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			if (!reserve(e.rgb_bytes + e.depth_bytes, e.offset)) {
+				dropped_cnt++;
+				return;
+			}
+			head = e.offset + e.rgb_bytes + e.depth_bytes;
+		}
+
+		// the reserved bytes aren't published yet, nobody else reads them
+		uint8_t * p = arena.get() + e.offset;
+		if (compress) {
+			std::memcpy(p, &rgb_buf[0], e.rgb_bytes);
+			std::memcpy(p + e.rgb_bytes, &depth_buf[0], e.depth_bytes);
+		} else {
+			copyPlane(f.rgb, p);
+			copyPlane(f.depth, p + e.rgb_bytes);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			at(next) = e;
+			next++;
+			stored += e.rgb_bytes + e.depth_bytes;
+			while (at(first).time + toDuration(seconds) < e.time && evict()) {}
+		}
+		wake.notify_all();
+	}
+
+	static void copyPlane(const cv::Mat & m, uint8_t * dst) {
+		size_t row_bytes = m.cols * m.elemSize();
+		for (int y = 0; y < m.rows; ++y) std::memcpy(dst + y * row_bytes, m.ptr(y), row_bytes);
+	}
+
+	// Entry back into a frame for kvr_writer, views into the arena where
+	// it was stored raw.
+	void load(const entry & e, frame & f) {
+		uint8_t * p = arena.get() + e.offset;
+		if (e.encoded) {
+			f.rgb = cv::imdecode(cv::Mat(1, (int)e.rgb_bytes, CV_8UC1, p), cv::IMREAD_COLOR);
+			if (!depth_codec::decode(p + e.rgb_bytes, e.depth_bytes, f.depth, cv::Size(e.depth_cols, e.depth_rows))) f.depth.release();
+		} else {
+			f.rgb = cv::Mat(e.rows, e.cols, e.rgb_type, p);
+			f.depth = cv::Mat(e.depth_rows, e.depth_cols, CV_16UC1, p + e.rgb_bytes);
+		}
+		f.seq = e.seq;
+		f.rgb_ts = e.rgb_ts;
+		f.depth_ts = e.depth_ts;
+		f.time = e.time;
+	}
+
+	void flush() {
+		std::unique_lock<std::mutex> lock(mtx);
+		for (;;) {
+			wake.wait(lock, [this] { return flushing || !active; });
+			if (!active) break;
+
+			std::string path = clip_path;
+			lock.unlock();
+			bool ok = clip.open(path, compress_depth);
+			lock.lock();
+
+			while (ok && active) {
+				if (flush_from == next) {
+					// the source may have stopped before the window closed
+					if (std::chrono::steady_clock::now() > flush_deadline) break;
+					wake.wait_for(lock, std::chrono::milliseconds(100));
+					continue;
+				}
+				entry e = at(flush_from);
+				if (e.time > flush_until) break;
+				lock.unlock();
+				load(e, scratch);
+				bool written = !scratch.rgb.empty() && !scratch.depth.empty() && clip.write(scratch);
+				ok = !clip.failed();
+				lock.lock();
+				flush_from++;
+				saved_cnt += written;
+			}
+
+			lock.unlock();
+			if (!clip.close()) ok = false;
+			scratch = frame();
+			if (ok) std::cout << "Saved " << saved_cnt << " frames to " << path << std::endl;
+			else std::cerr << "Can't save clip: " << path << std::endl;
+			lock.lock();
+			flushing = false;
+		}
+		clip.close();
+	}
+
+	// capture to buffer thread
+	size_t nslots;
+	job_queue<frame_ref> incoming;
+
+	// the arena and its frames, guarded by mtx
+	std::unique_ptr<uint8_t[]> arena;
+	size_t arena_size;
+	size_t head;
+	std::vector<entry> entries;
+	uint64_t first, next;
+	size_t stored;
+
+	// buffer thread only
+	std::vector<uint8_t> rgb_buf, depth_buf;
+
+	// clip being saved, frames [flush_from, next) up to flush_until
+	std::atomic<bool> flushing;
+	uint64_t flush_from;
+	std::chrono::system_clock::time_point flush_until;
+	std::chrono::steady_clock::time_point flush_deadline;
+	std::string clip_path;
+	kvr_writer clip;
+	frame scratch;
+
+	std::thread flush_thread;
+	std::mutex mtx;
+	std::condition_variable wake;
+	std::atomic<bool> active;
+
+	std::atomic<uint64_t> dropped_cnt;
+	std::atomic<uint64_t> saved_cnt;
+};
+
+#endif
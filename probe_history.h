@@ -0,0 +1,248 @@
+#ifndef PROBE_HISTORY_H
+#define PROBE_HISTORY_H
+
+#include <opencv2/opencv.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Sliding-window min and max of the valid (non-zero) samples of one trace.
+//
+// Two monotonic deques of (sample index, value): the front of each is the
+// current extreme, and a new sample first drops every entry it beats from
+// the back, so push() is amortized O(1) however long the window is. The
+// deques live in fixed rings of window entries, nothing is allocated after
+// reset().
+class window_extrema {
+public:
+	window_extrema() : window(0) {}
+
+	void reset(size_t size) {
+		window = size;
+		lows.reset(size);
+		highs.reset(size);
+	}
+
+	// Sample t (consecutive indices) with value v, 0 = invalid.
+	void push(uint64_t t, uint16_t v) {
+		lows.expire(t, window);
+		highs.expire(t, window);
+		if (v == 0) return;
+		while (!lows.empty() && lows.back().value >= v) lows.popBack();
+		lows.pushBack(t, v);
+		while (!highs.empty() && highs.back().value <= v) highs.popBack();
+		highs.pushBack(t, v);
+	}
+
+	bool empty() const { return lows.empty(); }
+	uint16_t min() const { return lows.front().value; }
+	uint16_t max() const { return highs.front().value; }
+
+private:
+	struct entry {
+		uint64_t t;
+		uint16_t value;
+	};
+
+	class deque {
+	public:
+		deque() : head(0), count(0) {}
+
+		void reset(size_t capacity) {
+			items.assign(capacity, entry());
+			head = count = 0;
+		}
+
+		bool empty() const { return count == 0; }
+		const entry & front() const { return items[head]; }
+		const entry & back() const { return items[(head + count - 1) % items.size()]; }
+
+		void pushBack(uint64_t t, uint16_t v) {
+			entry & e = items[(head + count) % items.size()];
+			e.t = t;
+			e.value = v;
+			count++;
+		}
+
+		void popBack() { count--; }
+
+		// drops entries that left the window ending at sample t
+		void expire(uint64_t t, size_t window) {
+			while (count && items[head].t + window <= t) {
+				head = (head + 1) % items.size();
+				count--;
+			}
+		}
+
+	private:
+		std::vector<entry> items;
+		size_t head, count;
+	};
+
+	size_t window;
+	deque lows, highs;
+};
+
+// Depth traces of any number of named probe points.
+//
+// All traces share one CV_16UC1 ring: row i belongs to probe i and sample t
+// is stored in column t % length(), so the whole history is one contiguous
+// block and sample() is a single gather of precomputed pixel offsets per
+// frame. Each trace keeps its window min/max up to date as samples arrive.
+class probe_history {
+public:
+	struct probe {
+		std::string name;
+		cv::Point pos;  // frame pixels
+		cv::Scalar color;
+	};
+
+	explicit probe_history(int size = 800) :
+		added(0), history_size(size), taken(0), changes(0), frame_cols(0), frame_rows(0), frame_step(0)
+	{
+	}
+
+	void add(const std::string & name, cv::Point pos) {
+		probe p;
+		p.name = name.empty() ? "p" + std::to_string(added + 1) : name;
+		p.pos = pos;
+		p.color = color(added++);
+		std::vector<int> rows(probes.size() + 1, -1);
+		for (size_t i = 0; i < probes.size(); ++i) rows[i] = i;
+		probes.push_back(p);
+		keepRows(rows);
+	}
+
+	// Removes the probes within radius pixels of pos, returns whether any were.
+	bool removeNear(cv::Point pos, int radius) {
+		std::vector<probe> kept;
+		std::vector<int> rows;
+		for (size_t i = 0; i < probes.size(); ++i) {
+			cv::Point d = probes[i].pos - pos;
+			if (d.x * d.x + d.y * d.y <= radius * radius) continue;
+			kept.push_back(probes[i]);
+			rows.push_back(i);
+		}
+		if (kept.size() == probes.size()) return false;
+		probes.swap(kept);
+		keepRows(rows);
+		return true;
+	}
+
+	// Samples kept per probe, forgets the ones taken so far.
+	void setLength(int size) {
+		history_size = size;
+		history = cv::Mat::zeros(probes.size(), size, CV_16UC1);
+		extrema.assign(probes.size(), window_extrema());
+		for (size_t i = 0; i < extrema.size(); ++i) extrema[i].reset(size);
+		taken = 0;
+		changes++;
+	}
+
+	// Forgets the samples, keeps the probes.
+	void clear() {
+		history.setTo(cv::Scalar::all(0));
+		for (size_t i = 0; i < extrema.size(); ++i) extrema[i].reset(history_size);
+		taken = 0;
+		changes++;
+	}
+
+	void sample(const cv::Mat & depth) {
+		if (probes.empty()) return;
+		CV_Assert(depth.type() == CV_16UC1);
+		if (depth.cols != frame_cols || depth.rows != frame_rows || depth.step != frame_step) {
+			frame_cols = depth.cols;
+			frame_rows = depth.rows;
+			frame_step = depth.step;
+			offsets.clear();
+		}
+		if (offsets.size() != probes.size()) updateOffsets();
+
+		const uint8_t * base = depth.data;
+		uint16_t * col = history.ptr<uint16_t>() + taken % history_size;
+		size_t row_step = history.step1();
+		for (size_t i = 0; i < offsets.size(); ++i) {
+			uint16_t v = offsets[i] >= 0 ? *(const uint16_t *)(base + offsets[i]) : 0;
+			col[i * row_step] = v;
+			extrema[i].push(taken, v);
+		}
+		taken++;
+	}
+
+	size_t size() const { return probes.size(); }
+	const probe & operator[](size_t i) const { return probes[i]; }
+
+	// row i holds probe i, sample t at column t % length()
+	const cv::Mat & samples() const { return history; }
+	int length() const { return history_size; }
+
+	// samples taken since the last clear(), t of the next one
+	uint64_t count() const { return taken; }
+
+	// sample t of probe i, 0 when it's no longer (or not yet) in the ring
+	uint16_t at(size_t i, uint64_t t) const {
+		if (t >= taken || t + history_size < taken) return 0;
+		return history.at<uint16_t>(i, t % history_size);
+	}
+
+	// latest sample of probe i
+	int last(size_t i) const { return taken ? at(i, taken - 1) : 0; }
+
+	// valid min/max of probe i over the ring
+	const window_extrema & range(size_t i) const { return extrema[i]; }
+
+	// bumped whenever probes come or go or the samples are cleared
+	uint64_t version() const { return changes; }
+
+private:
+	static cv::Scalar color(size_t i) {
+		// golden angle hue steps keep neighbours apart for any count
+		cv::Mat hsv(1, 1, CV_8UC3, cv::Scalar((i * 111) % 180, 200, 255)), bgr;
+		cv::cvtColor(hsv, bgr, cv::COLOR_HSV2BGR);
+		return cv::Scalar(bgr.at<cv::Vec3b>(0, 0));
+	}
+
+	// New ring with row i taken from old row rows[i], or empty for -1. Only
+	// runs when probes come or go.
+	void keepRows(const std::vector<int> & rows) {
+		cv::Mat ring(rows.size(), history_size, CV_16UC1, cv::Scalar::all(0));
+		std::vector<window_extrema> kept(rows.size());
+		for (size_t i = 0; i < rows.size(); ++i) {
+			if (rows[i] >= 0) {
+				history.row(rows[i]).copyTo(ring.row(i));
+				kept[i] = extrema[rows[i]];
+			} else {
+				kept[i].reset(history_size);
+			}
+		}
+		history = ring;
+		extrema.swap(kept);
+		offsets.clear();
+		changes++;
+	}
+
+	void updateOffsets() {
+		offsets.resize(probes.size());
+		for (size_t i = 0; i < probes.size(); ++i) {
+			cv::Point p = probes[i].pos;
+			bool inside = p.x >= 0 && p.y >= 0 && p.x < frame_cols && p.y < frame_rows;
+			offsets[i] = inside ? (long)(p.y * frame_step + p.x * sizeof(uint16_t)) : -1;
+		}
+	}
+
+	std::vector<probe> probes;
+	int added;
+
+	int history_size;
+	cv::Mat history;
+	std::vector<window_extrema> extrema;
+	uint64_t taken;
+	uint64_t changes;
+
+	int frame_cols, frame_rows;
+	size_t frame_step;
+	std::vector<long> offsets;
+};
+
+#endif
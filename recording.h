@@ -0,0 +1,273 @@
+#ifndef RECORDING_H
+#define RECORDING_H
+
+#include <opencv2/opencv.hpp>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "date.h"
+#include "depth_codec.h"
+#include "frame.h"
+#include "frame_pool.h"
+#include "job_queue.h"
+
+// Session recording container (.kvr).
+//
+// A 64-byte file header followed by chunks. Every chunk starts with a tag and
+// the size of what follows its 8-byte tag/size prefix, so readers can skip
+// chunk types they don't know. Chunk payloads are padded to 64 bytes, which
+// keeps the raw image data aligned when the file is memory mapped.
+//
+// FRME chunk: rec_frame header, then raw RGB (BGR, row-major) and the depth
+// plane, each padded to a multiple of 64 bytes. Depth is raw uint16 mm, or
+// one depth_codec stream when the header says REC_DEPTH_KVD.
+
+static const char REC_MAGIC[8] = { 'K', 'V', 'R', 'E', 'C', 0, 0, 0 };
+static const uint32_t REC_VERSION = 1;
+static const size_t REC_ALIGN = 64;
+
+enum rec_depth_format { REC_DEPTH_RAW = 0, REC_DEPTH_KVD = 1 };
+
+struct rec_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t rgb_type;    // OpenCV type of the RGB plane
+	uint32_t depth_type;  // OpenCV type of the depth plane
+	uint32_t depth_format;  // rec_depth_format
+	uint8_t reserved[32];
+};
+
+struct rec_frame {
+	char tag[4];          // "FRME"
+	uint32_t size;        // bytes following tag and size
+	uint64_t seq;
+	uint32_t depth_ts;    // device timestamp of the depth image
+	uint32_t rgb_bytes;   // unpadded plane sizes, depth_bytes encoded
+	uint32_t depth_bytes;
+	uint32_t rgb_ts;      // and of the RGB image
+	int64_t time_us;      // wall clock, microseconds since epoch
+	char time_str[24];    // same clock, "%Y-%m-%d_%H-%M-%S" with milliseconds
+};
+
+static_assert(sizeof(rec_header) == 64, "rec_header must stay 64 bytes");
+static_assert(sizeof(rec_frame) == 64, "rec_frame must stay 64 bytes");
+
+inline size_t recPadded(size_t n) {
+	return (n + REC_ALIGN - 1) / REC_ALIGN * REC_ALIGN;
+}
+
+// Writes frames to a .kvr file on the calling thread.
+class kvr_writer {
+public:
+	kvr_writer() : file(nullptr), header_written(false), depth_kvd(false), error(false), raw_bytes(0), stored_bytes(0) {}
+
+	~kvr_writer() {
+		close();
+	}
+
+	// compress_depth: depth planes as depth_codec streams
+	bool open(const std::string & path, bool compress_depth) {
+		close();
+		file = std::fopen(path.c_str(), "wb");
+		if (!file) {
+			std::cerr << "Can't open recording: " << path << std::endl;
+			return false;
+		}
+		io_buf.resize(8 << 20);
+		std::setvbuf(file, &io_buf[0], _IOFBF, io_buf.size());
+		header_written = false;
+		depth_kvd = compress_depth;
+		error = false;
+		raw_bytes = 0;
+		stored_bytes = 0;
+		return true;
+	}
+
+	// False when anything written since open() didn't reach the file.
+	bool close() {
+		if (!file) return !error;
+		if (std::fclose(file) != 0) error = true;
+		file = nullptr;
+		return !error;
+	}
+
+	bool isOpen() const { return file != nullptr; }
+
+	// A write error sticks until the next open(), later frames are refused.
+	bool failed() const { return error; }
+
+	// False when the frame didn't make it into the file.
+	bool write(const frame & f) {
+		if (error) return false;
+		if (!header_written && !writeHeader(f)) return false;
+
+		rec_frame r;
+		std::memset(&r, 0, sizeof(r));
+		std::memcpy(r.tag, "FRME", 4);
+		r.rgb_bytes = f.rgb.total() * f.rgb.elemSize();
+		r.depth_bytes = f.depth.total() * f.depth.elemSize();
+		raw_bytes += r.depth_bytes;
+		if (depth_kvd) r.depth_bytes = depth_codec::encode(f.depth, depth_buf);
+		stored_bytes += r.depth_bytes;
+		r.size = sizeof(r) - 8 + recPadded(r.rgb_bytes) + recPadded(r.depth_bytes);
+		r.seq = f.seq;
+		r.depth_ts = f.depth_ts;
+		r.rgb_ts = f.rgb_ts;
+
+		using namespace std::chrono;
+		auto ms = date::floor<milliseconds>(f.time);
+		r.time_us = duration_cast<microseconds>(f.time.time_since_epoch()).count();
+		std::string str = date::format("%Y-%m-%d_%H-%M-%S", ms);
+		std::strncpy(r.time_str, str.c_str(), sizeof(r.time_str) - 1);
+
+		if (!put(&r, sizeof(r)) || !writePlane(f.rgb)) return false;
+		if (depth_kvd) return put(&depth_buf[0], depth_buf.size()) && writePadding(depth_buf.size());
+		return writePlane(f.depth);
+	}
+
+	bool flush() {
+		if (std::fflush(file) != 0) fail();
+		return !error;
+	}
+
+	// stored depth bytes per raw one, 1 for raw recordings
+	double depthRatio() const {
+		uint64_t raw = raw_bytes;
+		return raw ? double(stored_bytes) / raw : 1.0;
+	}
+
+private:
+	bool writeHeader(const frame & f) {
+		rec_header h;
+		std::memset(&h, 0, sizeof(h));
+		std::memcpy(h.magic, REC_MAGIC, sizeof(h.magic));
+		h.version = REC_VERSION;
+		h.width = f.depth.cols;
+		h.height = f.depth.rows;
+		h.rgb_type = f.rgb.type();
+		h.depth_type = f.depth.type();
+		h.depth_format = depth_kvd ? REC_DEPTH_KVD : REC_DEPTH_RAW;
+		header_written = true;
+		return put(&h, sizeof(h));
+	}
+
+	bool writePlane(const cv::Mat & m) {
+		size_t row_bytes = m.cols * m.elemSize();
+		if (m.isContinuous()) {
+			if (!put(m.data, row_bytes * m.rows)) return false;
+		} else {
+			for (int y = 0; y < m.rows; ++y) {
+				if (!put(m.ptr(y), row_bytes)) return false;
+			}
+		}
+		return writePadding(row_bytes * m.rows);
+	}
+
+	bool writePadding(size_t bytes) {
+		static const char zeros[REC_ALIGN] = {};
+		return put(zeros, recPadded(bytes) - bytes);
+	}
+
+	bool put(const void * data, size_t bytes) {
+		if (bytes && std::fwrite(data, bytes, 1, file) != 1) fail();
+		return !error;
+	}
+
+	void fail() {
+		if (!error) std::cerr << "Write error in recording: " << std::strerror(errno) << std::endl;
+		error = true;
+	}
+
+	std::FILE * file;
+	std::vector<char> io_buf;
+	bool header_written;
+	bool depth_kvd;
+	std::atomic<bool> error;
+	std::vector<uint8_t> depth_buf;
+
+	// read by other threads for the status line
+	std::atomic<uint64_t> raw_bytes, stored_bytes;
+};
+
+// Continuous recorder. write() only queues a reference to the pooled frame
+// and returns; a writer thread streams the queued frames to disk in order.
+// When the disk can't keep up and all slots are in flight the frame is
+// dropped and counted rather than stalling the caller. Depth is compressed
+// on the writer thread unless compress_depth is off.
+class recorder {
+public:
+	explicit recorder(size_t slots = 30) :
+		compress_depth(true), nslots(slots), written_cnt(0), failed_cnt(0)
+	{
+	}
+
+	~recorder() {
+		stop();
+	}
+
+	bool start(const std::string & path) {
+		stop();
+		if (!out.open(path, compress_depth)) return false;
+
+		rec_path = path;
+		written_cnt = 0;
+		failed_cnt = 0;
+		frames.start(nslots, 1, [this](frame_ref & f) { run(f); });
+		return true;
+	}
+
+	// Flushes everything queued so far and closes the file.
+	void stop() {
+		if (!frames.running()) return;
+		frames.stop();
+		out.flush();
+		out.close();
+	}
+
+	// Called from the acquisition thread for every frame.
+	void write(const frame_ref & f) {
+		frames.push(f);
+	}
+
+	bool recording() const { return frames.running(); }
+	const std::string & path() const { return rec_path; }
+	uint64_t written() const { return written_cnt; }
+	uint64_t dropped() const { return frames.dropped() + failed_cnt; }
+	double depthRatio() const { return out.depthRatio(); }
+
+	// the file couldn't be written, frames since then are dropped
+	bool failed() const { return out.failed(); }
+
+	size_t queued() { return frames.queued(); }
+
+	// depth_codec for the depth planes, picked up by the next start()
+	bool compress_depth;
+
+private:
+	void run(frame_ref & f) {
+		if (out.write(*f)) written_cnt++;
+		else failed_cnt++;
+	}
+
+	size_t nslots;
+	kvr_writer out;
+	std::string rec_path;
+
+	std::atomic<uint64_t> written_cnt;
+	std::atomic<uint64_t> failed_cnt;  // refused after a write error
+
+	// last, so the writer stops before the file goes
+	job_queue<frame_ref> frames;
+};
+
+#endif
@@ -0,0 +1,217 @@
+#ifndef ROI_STATS_H
+#define ROI_STATS_H
+
+#include <opencv2/opencv.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+struct roi_result {
+	roi_result() : depth_mean(0), depth_std(0), depth_min(0), depth_max(0), valid(0) {}
+
+	// over valid (non-zero) depth only
+	double depth_mean, depth_std;
+	int depth_min, depth_max;
+	double valid;  // fraction of the ROI with valid depth
+
+	// over every pixel, BGR
+	cv::Vec3d rgb_mean, rgb_std;
+	cv::Vec3b rgb_min, rgb_max;
+};
+
+// Statistics of any number of rectangular ROIs.
+//
+// build() makes one pass over the frame for summed-area tables of depth,
+// depth squared, the valid count and RGB (cv::integral), after which mean,
+// std and valid fraction cost four lookups per ROI. Min and max don't
+// decompose like sums, so build() also keeps per tile min/max; a query
+// combines the tiles inside the ROI and scans only the partial tiles along
+// its border.
+class roi_stats {
+public:
+	explicit roi_stats(int tile = 8) : tile(tile), has_rgb(false) {}
+
+	void build(const cv::Mat & depth, const cv::Mat & rgb) {
+		CV_Assert(depth.type() == CV_16UC1);
+		this->depth = depth;
+		has_rgb = rgb.size() == depth.size() && rgb.type() == CV_8UC3;
+		this->rgb = has_rgb ? rgb : cv::Mat();
+
+		int w = depth.cols, h = depth.rows;
+		stride = w + 1;
+		d_sum.resize(stride * (h + 1));
+		d_sq.resize(stride * (h + 1));
+		d_cnt.resize(stride * (h + 1));
+		std::fill(d_sum.begin(), d_sum.begin() + stride, 0);
+		std::fill(d_sq.begin(), d_sq.begin() + stride, 0);
+		std::fill(d_cnt.begin(), d_cnt.begin() + stride, 0);
+		for (int y = 0; y < h; ++y) {
+			const uint16_t * d = depth.ptr<uint16_t>(y);
+			const int64_t * sum_up = &d_sum[y * stride];
+			const int64_t * sq_up = &d_sq[y * stride];
+			const int32_t * cnt_up = &d_cnt[y * stride];
+			int64_t * sum = &d_sum[(y + 1) * stride];
+			int64_t * sq = &d_sq[(y + 1) * stride];
+			int32_t * cnt = &d_cnt[(y + 1) * stride];
+			sum[0] = sq[0] = cnt[0] = 0;
+			int64_t rs = 0, rq = 0;
+			int32_t rc = 0;
+			for (int x = 0; x < w; ++x) {
+				int64_t v = d[x];
+				rs += v;
+				rq += v * v;
+				rc += v != 0;
+				sum[x + 1] = sum_up[x + 1] + rs;
+				sq[x + 1] = sq_up[x + 1] + rq;
+				cnt[x + 1] = cnt_up[x + 1] + rc;
+			}
+		}
+		if (has_rgb) cv::integral(rgb, rgb_sum, rgb_sq, CV_32S, CV_64F);
+
+		buildTiles();
+	}
+
+	roi_result query(cv::Rect r) const {
+		roi_result res;
+		r &= cv::Rect(0, 0, depth.cols, depth.rows);
+		if (r.area() == 0) return res;
+
+		int x0 = r.x, y0 = r.y, x1 = r.x + r.width, y1 = r.y + r.height;
+		int64_t cnt = areaSum(d_cnt, x0, y0, x1, y1);
+		res.valid = double(cnt) / r.area();
+		if (cnt > 0) {
+			double mean = double(areaSum(d_sum, x0, y0, x1, y1)) / cnt;
+			double sq = double(areaSum(d_sq, x0, y0, x1, y1)) / cnt;
+			res.depth_mean = mean;
+			res.depth_std = std::sqrt(std::max(sq - mean * mean, 0.0));
+		}
+		if (has_rgb) {
+			for (int c = 0; c < 3; ++c) {
+				double mean = rgbSum(rgb_sum, x0, y0, x1, y1, c) / r.area();
+				double sq = rgbSum(rgb_sq, x0, y0, x1, y1, c) / r.area();
+				res.rgb_mean[c] = mean;
+				res.rgb_std[c] = std::sqrt(std::max(sq - mean * mean, 0.0));
+			}
+		}
+		minMax(r, res);
+		return res;
+	}
+
+private:
+	struct tile_range {
+		uint16_t dmin, dmax;
+		cv::Vec3b cmin, cmax;
+	};
+
+	template<typename T>
+	T areaSum(const std::vector<T> & t, int x0, int y0, int x1, int y1) const {
+		return t[y1 * stride + x1] - t[y0 * stride + x1] - t[y1 * stride + x0] + t[y0 * stride + x0];
+	}
+
+	template<typename T>
+	static double rgbSum(const cv::Mat & t, int x0, int y0, int x1, int y1, int c) {
+		typedef cv::Vec<T, 3> px;
+		return double(t.at<px>(y1, x1)[c]) - t.at<px>(y0, x1)[c] - t.at<px>(y1, x0)[c] + t.at<px>(y0, x0)[c];
+	}
+
+	static double rgbSum(const cv::Mat & t, int x0, int y0, int x1, int y1, int c) {
+		return t.depth() == CV_32S ? rgbSum<int>(t, x0, y0, x1, y1, c) : rgbSum<double>(t, x0, y0, x1, y1, c);
+	}
+
+	static void widen(tile_range & t, uint16_t d, const cv::Vec3b * c) {
+		if (d != 0) {
+			t.dmin = std::min(t.dmin, d);
+			t.dmax = std::max(t.dmax, d);
+		}
+		if (c) {
+			for (int i = 0; i < 3; ++i) {
+				t.cmin[i] = std::min(t.cmin[i], (*c)[i]);
+				t.cmax[i] = std::max(t.cmax[i], (*c)[i]);
+			}
+		}
+	}
+
+	static tile_range emptyRange() {
+		tile_range t;
+		t.dmin = 0xffff;
+		t.dmax = 0;
+		t.cmin = cv::Vec3b(255, 255, 255);
+		t.cmax = cv::Vec3b(0, 0, 0);
+		return t;
+	}
+
+	static void merge(tile_range & a, const tile_range & b) {
+		a.dmin = std::min(a.dmin, b.dmin);
+		a.dmax = std::max(a.dmax, b.dmax);
+		for (int i = 0; i < 3; ++i) {
+			a.cmin[i] = std::min(a.cmin[i], b.cmin[i]);
+			a.cmax[i] = std::max(a.cmax[i], b.cmax[i]);
+		}
+	}
+
+	void scan(tile_range & t, int x0, int y0, int x1, int y1) const {
+		for (int y = y0; y < y1; ++y) {
+			const uint16_t * d = depth.ptr<uint16_t>(y);
+			const cv::Vec3b * c = has_rgb ? rgb.ptr<cv::Vec3b>(y) : nullptr;
+			for (int x = x0; x < x1; ++x) widen(t, d[x], c ? c + x : nullptr);
+		}
+	}
+
+	void buildTiles() {
+		tiles_x = (depth.cols + tile - 1) / tile;
+		tiles_y = (depth.rows + tile - 1) / tile;
+		tiles.assign(tiles_x * tiles_y, emptyRange());
+		for (int ty = 0; ty < tiles_y; ++ty) {
+			for (int tx = 0; tx < tiles_x; ++tx) {
+				scan(tiles[ty * tiles_x + tx], tx * tile, ty * tile,
+					std::min((tx + 1) * tile, depth.cols), std::min((ty + 1) * tile, depth.rows));
+			}
+		}
+	}
+
+	void minMax(cv::Rect r, roi_result & res) const {
+		int x0 = r.x, y0 = r.y, x1 = r.x + r.width, y1 = r.y + r.height;
+		tile_range t = emptyRange();
+
+		// whole tiles inside the ROI
+		int tx0 = (x0 + tile - 1) / tile, tx1 = x1 / tile;
+		int ty0 = (y0 + tile - 1) / tile, ty1 = y1 / tile;
+		if (tx0 < tx1 && ty0 < ty1) {
+			for (int ty = ty0; ty < ty1; ++ty) {
+				for (int tx = tx0; tx < tx1; ++tx) merge(t, tiles[ty * tiles_x + tx]);
+			}
+			int ix0 = tx0 * tile, ix1 = tx1 * tile, iy0 = ty0 * tile, iy1 = ty1 * tile;
+			scan(t, x0, y0, x1, iy0);
+			scan(t, x0, iy1, x1, y1);
+			scan(t, x0, iy0, ix0, iy1);
+			scan(t, ix1, iy0, x1, iy1);
+		} else {
+			scan(t, x0, y0, x1, y1);
+		}
+
+		if (t.dmax > 0) {
+			res.depth_min = t.dmin;
+			res.depth_max = t.dmax;
+		}
+		if (has_rgb) {
+			res.rgb_min = t.cmin;
+			res.rgb_max = t.cmax;
+		}
+	}
+
+	int tile;
+	cv::Mat depth, rgb;
+	bool has_rgb;
+
+	int stride;
+	std::vector<int64_t> d_sum, d_sq;
+	std::vector<int32_t> d_cnt;
+	cv::Mat rgb_sum, rgb_sq;
+
+	int tiles_x, tiles_y;
+	std::vector<tile_range> tiles;
+};
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef SLOT_QUEUE_H
+#define SLOT_QUEUE_H
+
+#include <cstddef>
+#include <vector>
+
+// Fixed-capacity FIFO of slot ids, queueing never allocates.
+class slot_queue {
+public:
+	slot_queue() : head(0), count(0) {}
+
+	void reset(size_t capacity) {
+		ids.assign(capacity, 0);
+		head = 0;
+		count = 0;
+	}
+
+	bool empty() const { return count == 0; }
+	size_t size() const { return count; }
+
+	void push(size_t id) {
+		ids[(head + count) % ids.size()] = id;
+		count++;
+	}
+
+	size_t pop() {
+		size_t id = ids[head];
+		head = (head + 1) % ids.size();
+		count--;
+		return id;
+	}
+
+private:
+	std::vector<size_t> ids;
+	size_t head, count;
+};
+
+#endif
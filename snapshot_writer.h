@@ -0,0 +1,105 @@
+#ifndef SNAPSHOT_WRITER_H
+#define SNAPSHOT_WRITER_H
+
+#include <opencv2/opencv.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <string>
+
+#include "depth_codec.h"
+#include "frame.h"
+#include "frame_pool.h"
+#include "job_queue.h"
+
+// Saves snapshots (color PNG plus PNG or .kvd depth) on a pool of writer
+// threads. save() only queues a reference to the pooled frame, so the UI
+// never waits on image encoding and snapshots taken in quick succession are
+// written side by side. When every slot is taken the snapshot is dropped
+// and counted.
+class snapshot_writer {
+public:
+	explicit snapshot_writer(size_t threads = 2, size_t slots = 8) :
+		depth_kvd(false), written_cnt(0), failed_cnt(0), last_ms(0)
+	{
+		jobs.start(slots, threads, [this](job & j) { run(j); });
+	}
+
+	// Writes what's queued, then stops the threads.
+	~snapshot_writer() {
+		jobs.stop();
+	}
+
+	// Files are base + "_c.png" and base + "_d.png" (or "_d.kvd").
+	bool save(const frame_ref & f, const std::string & base) {
+		job j;
+		j.f = f;
+		j.base = base;
+		j.depth_kvd = depth_kvd;
+		return jobs.push(j);
+	}
+
+	// saved depth as .kvd rather than 16-bit PNG
+	std::atomic<bool> depth_kvd;
+
+	uint64_t written() const { return written_cnt; }
+	uint64_t dropped() const { return jobs.dropped(); }
+	uint64_t failed() const { return failed_cnt; }
+	float lastMs() const { return last_ms; }
+
+	// waiting or being written
+	size_t queued() { return jobs.queued(); }
+
+	// base name of the last snapshot written and how long ago that was
+	std::string last(double & age_s) {
+		std::lock_guard<std::mutex> lock(mtx);
+		age_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - last_done).count();
+		return last_base;
+	}
+
+private:
+	struct job {
+		job() : depth_kvd(false) {}
+		frame_ref f;
+		std::string base;
+		bool depth_kvd;
+	};
+
+	void run(job & j) {
+		auto start = std::chrono::steady_clock::now();
+		bool ok = write(*j.f, j.base, j.depth_kvd);
+		last_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+		if (!ok) {
+			failed_cnt++;
+			return;
+		}
+		written_cnt++;
+		std::lock_guard<std::mutex> lock(mtx);
+		last_base = j.base;
+		last_done = std::chrono::steady_clock::now();
+	}
+
+	static bool write(const frame & f, const std::string & base, bool depth_kvd) {
+		bool ok = depth_kvd ? writeDepthFile(base + "_d.kvd", f.depth) : cv::imwrite(base + "_d.png", f.depth);
+		ok = cv::imwrite(base + "_c.png", f.rgb) && ok;
+		if (!ok) std::cerr << "Can't save snapshot: " << base << std::endl;
+		return ok;
+	}
+
+	std::atomic<uint64_t> written_cnt;
+	std::atomic<uint64_t> failed_cnt;
+	std::atomic<float> last_ms;
+
+	// last snapshot written
+	std::mutex mtx;
+	std::string last_base;
+	std::chrono::steady_clock::time_point last_done;
+
+	// last, so the workers stop before the rest goes
+	job_queue<job> jobs;
+};
+
+#endif
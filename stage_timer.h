@@ -0,0 +1,155 @@
+#ifndef STAGE_TIMER_H
+#define STAGE_TIMER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Per-stage frame timing. Stages report their time with a scoped_timer (or
+// add() for times measured elsewhere, e.g. on the acquisition thread), and
+// endFrame() folds the frame into rolling min/mean/p99 statistics and
+// optionally appends it as a CSV row.
+enum stage {
+	STAGE_ACQUIRE,
+	STAGE_CONVERT,
+	STAGE_FILTER,
+	STAGE_FILL,
+	STAGE_COLORIZE,
+	STAGE_BLEND,
+	STAGE_HISTOGRAM,
+	STAGE_ROI,
+	STAGE_DRAW_HIST,
+	STAGE_DRAW_HISTORY,
+	STAGE_COMPOSE,
+	STAGE_SHOW,
+	STAGE_COUNT
+};
+
+inline const char * stageName(int s) {
+	static const char * names[STAGE_COUNT] = {
+		"acquire", "convert", "filter", "hole fill", "colorize", "blend", "histogram", "roi stats",
+		"draw hist", "draw history", "compose", "show"
+	};
+	return names[s];
+}
+
+// Rolling window of one stage's times in ms.
+class stage_stats {
+public:
+	explicit stage_stats(size_t window = 256) : samples(window), count(0), pos(0) {}
+
+	void add(double ms) {
+		samples[pos] = ms;
+		pos = (pos + 1) % samples.size();
+		count = std::min(count + 1, samples.size());
+	}
+
+	bool empty() const { return count == 0; }
+
+	double min() const {
+		return count ? *std::min_element(samples.begin(), samples.begin() + count) : 0;
+	}
+
+	double mean() const {
+		double sum = 0;
+		for (size_t i = 0; i < count; ++i) sum += samples[i];
+		return count ? sum / count : 0;
+	}
+
+	double p99() const {
+		if (!count) return 0;
+		sorted.assign(samples.begin(), samples.begin() + count);
+		size_t k = (count * 99) / 100;
+		std::nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+		return sorted[k];
+	}
+
+private:
+	std::vector<double> samples;
+	mutable std::vector<double> sorted;
+	size_t count, pos;
+};
+
+class frame_timer {
+public:
+	frame_timer() : stats(STAGE_COUNT), current(STAGE_COUNT, 0), hit(STAGE_COUNT, false), csv(nullptr), frames(0) {}
+
+	~frame_timer() {
+		if (csv) std::fclose(csv);
+	}
+
+	bool openCsv(const std::string & path) {
+		csv = std::fopen(path.c_str(), "w");
+		if (!csv) {
+			std::cerr << "Can't open timing log: " << path << std::endl;
+			return false;
+		}
+		std::fprintf(csv, "frame");
+		for (int s = 0; s < STAGE_COUNT; ++s) std::fprintf(csv, ",%s", stageName(s));
+		std::fprintf(csv, "\n");
+		return true;
+	}
+
+	void add(int s, double ms) {
+		current[s] += ms;
+		hit[s] = true;
+	}
+
+	void endFrame() {
+		if (csv) std::fprintf(csv, "%llu", (unsigned long long)frames);
+		for (int s = 0; s < STAGE_COUNT; ++s) {
+			if (hit[s]) stats[s].add(current[s]);
+			if (csv) {
+				if (hit[s]) std::fprintf(csv, ",%.3f", current[s]);
+				else std::fprintf(csv, ",");
+			}
+			current[s] = 0;
+			hit[s] = false;
+		}
+		if (csv) std::fprintf(csv, "\n");
+		frames++;
+	}
+
+	const stage_stats & get(int s) const { return stats[s]; }
+
+	// One line per stage that has samples: name, min, mean, p99 in ms.
+	std::string report() const {
+		std::string out;
+		char line[96];
+		for (int s = 0; s < STAGE_COUNT; ++s) {
+			if (stats[s].empty()) continue;
+			std::snprintf(line, sizeof(line), "%-12s %7.2f %7.2f %7.2f\n", stageName(s), stats[s].min(), stats[s].mean(), stats[s].p99());
+			out += line;
+		}
+		return out;
+	}
+
+private:
+	std::vector<stage_stats> stats;
+	std::vector<double> current;
+	std::vector<bool> hit;
+	std::FILE * csv;
+	uint64_t frames;
+};
+
+// Adds the time until the end of the scope to a stage. A null timer makes
+// it a no-op, so instrumented code doesn't need a timer to run.
+class scoped_timer {
+public:
+	scoped_timer(frame_timer * timer, int s) : timer(timer), s(s), start(std::chrono::steady_clock::now()) {}
+
+	~scoped_timer() {
+		if (timer) timer->add(s, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+	}
+
+private:
+	frame_timer * timer;
+	int s;
+	std::chrono::steady_clock::time_point start;
+};
+
+#endif
@@ -0,0 +1,190 @@
+#ifndef SYNTHETIC_SOURCE_H
+#define SYNTHETIC_SOURCE_H
+
+#include <opencv2/opencv.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "frame_source.h"
+
+struct synthetic_config {
+	synthetic_config() :
+		width(640), height(480), fps(30), planes(2), spheres(3),
+		noise(4), holes(0.02), seed(1) {}
+
+	int width, height;
+	double fps;      // 0 = as fast as the consumer takes them, none dropped
+	int planes;      // tilted, slowly moving background planes
+	int spheres;     // spheres moving across the view
+	double noise;    // depth noise sigma [mm]
+	double holes;    // fraction of the frame covered by invalid (0) blobs
+	uint32_t seed;
+};
+
+// Procedural scene for running the pipeline without a sensor: moving planes
+// and spheres with a Kinect-like shadow band of invalid depth on their left
+// edge, random holes and depth noise, at any resolution and rate.
+class synthetic_source : public frame_source {
+public:
+	explicit synthetic_source(const synthetic_config & cfg = synthetic_config()) :
+		cfg(cfg), rng(cfg.seed ? cfg.seed : 1), tick(0)
+	{
+		for (int i = 0; i < cfg.planes; ++i) {
+			plane p;
+			p.base = 1500 + 1500 * i + uniform() * 500;
+			p.ax = (uniform() - 0.5) * 2;
+			p.ay = (uniform() - 0.5) * 2;
+			p.x0 = cfg.width * (i + 1) / (cfg.planes + 1);
+			p.phase = uniform() * 6.28;
+			planes.push_back(p);
+		}
+		for (int i = 0; i < cfg.spheres; ++i) {
+			sphere s;
+			s.r = std::min(cfg.width, cfg.height) * (0.08 + 0.08 * uniform());
+			s.z = 800 + 1500 * uniform();
+			s.fx = 0.3 + uniform();
+			s.fy = 0.3 + uniform();
+			s.phase = uniform() * 6.28;
+			s.color = cv::Vec3b(64 + 191 * uniform(), 64 + 191 * uniform(), 64 + 191 * uniform());
+			spheres.push_back(s);
+		}
+		next_due = std::chrono::steady_clock::now();
+	}
+
+	bool lossless() const { return cfg.fps <= 0; }
+
+	result grab(frame & f) {
+		if (cfg.fps > 0) {
+			next_due += std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / cfg.fps));
+			std::this_thread::sleep_until(next_due);
+		}
+
+		f.rgb.create(cfg.height, cfg.width, CV_8UC3);
+		f.depth.create(cfg.height, cfg.width, CV_16UC1);
+		double t = tick++ / 30.0;
+
+		renderPlanes(f, t);
+		for (size_t i = 0; i < spheres.size(); ++i) renderSphere(f, spheres[i], t);
+		addHoles(f);
+		addNoise(f);
+
+		f.rgb_ts = f.depth_ts = (uint32_t)(uint64_t)(t * 1000 * FRAME_TICKS_PER_MS);
+		stamp(f);
+		return FRAME;
+	}
+
+private:
+	struct plane {
+		double base, ax, ay, x0, phase;
+	};
+
+	struct sphere {
+		double r, z, fx, fy, phase;
+		cv::Vec3b color;
+	};
+
+	uint32_t next() {
+		// xorshift32
+		rng ^= rng << 13;
+		rng ^= rng >> 17;
+		rng ^= rng << 5;
+		return rng;
+	}
+
+	double uniform() {
+		return next() * (1.0 / 4294967296.0);
+	}
+
+	// Planes split the view into vertical bands, each band one plane.
+	void renderPlanes(frame & f, double t) {
+		if (planes.empty()) {
+			f.depth.setTo(cv::Scalar::all(0));
+			f.rgb.setTo(cv::Scalar::all(0));
+			return;
+		}
+		int n = planes.size();
+		for (int y = 0; y < cfg.height; ++y) {
+			uint16_t * d = f.depth.ptr<uint16_t>(y);
+			cv::Vec3b * c = f.rgb.ptr<cv::Vec3b>(y);
+			for (int x = 0; x < cfg.width; ++x) {
+				int band = std::min(x * n / cfg.width, n - 1);
+				bool checker = ((x >> 5) ^ (y >> 5)) & 1;
+				const plane & p = planes[band];
+				double z = p.base + 300 * std::sin(t * 0.5 + p.phase) + p.ax * (x - p.x0) + p.ay * (y - cfg.height / 2);
+				d[x] = cv::saturate_cast<uint16_t>(z);
+				uchar v = checker ? 160 : 96;
+				c[x] = cv::Vec3b(v, v - 20 * band, v + 20 * band);
+			}
+		}
+	}
+
+	void renderSphere(frame & f, const sphere & s, double t) {
+		double cx = cfg.width * (0.5 + 0.4 * std::sin(t * s.fx + s.phase));
+		double cy = cfg.height * (0.5 + 0.35 * std::cos(t * s.fy + s.phase));
+		// scale from pixels to millimetres along the view axis
+		double k = s.z / (cfg.width * 1.2);
+		int shadow = std::max(2, cfg.width / 80);
+
+		int y0 = std::max(0, (int)(cy - s.r)), y1 = std::min(cfg.height - 1, (int)(cy + s.r));
+		for (int y = y0; y <= y1; ++y) {
+			uint16_t * d = f.depth.ptr<uint16_t>(y);
+			cv::Vec3b * c = f.rgb.ptr<cv::Vec3b>(y);
+			double dy = y - cy;
+			double half = std::sqrt(std::max(0.0, s.r * s.r - dy * dy));
+			int x0 = std::max(0, (int)(cx - half) - shadow), x1 = std::min(cfg.width - 1, (int)(cx + half));
+			for (int x = x0; x <= x1; ++x) {
+				double dx = x - cx;
+				double h2 = s.r * s.r - dx * dx - dy * dy;
+				if (h2 < 0) {
+					// shadow band left of the silhouette, no depth there
+					if (dx < 0) d[x] = 0;
+					continue;
+				}
+				double h = std::sqrt(h2);
+				uint16_t z = cv::saturate_cast<uint16_t>(s.z - h * k);
+				if (d[x] != 0 && d[x] < z) continue;
+				d[x] = z;
+				double shade = 0.4 + 0.6 * h / s.r;
+				c[x] = cv::Vec3b(s.color[0] * shade, s.color[1] * shade, s.color[2] * shade);
+			}
+		}
+	}
+
+	void addHoles(frame & f) {
+		double area = cfg.width * cfg.height * cfg.holes;
+		int r = std::max(2, cfg.width / 100);
+		int count = area / (3.14 * r * r);
+		for (int i = 0; i < count; ++i) {
+			cv::Point p(next() % cfg.width, next() % cfg.height);
+			cv::circle(f.depth, p, r, cv::Scalar::all(0), -1);
+		}
+	}
+
+	void addNoise(frame & f) {
+		if (cfg.noise <= 0) return;
+		// sum of four uniforms, close enough to gaussian and cheap
+		double scale = cfg.noise / (2 * 0.2887 * 65536);
+		for (int y = 0; y < cfg.height; ++y) {
+			uint16_t * d = f.depth.ptr<uint16_t>(y);
+			for (int x = 0; x < cfg.width; ++x) {
+				uint32_t a = next(), b = next();
+				int s = (int)(a & 0xffff) + (int)(a >> 16) + (int)(b & 0xffff) + (int)(b >> 16) - 2 * 65536;
+				if (d[x]) d[x] = cv::saturate_cast<uint16_t>(d[x] + s * scale);
+			}
+		}
+	}
+
+	synthetic_config cfg;
+	uint32_t rng;
+	uint64_t tick;
+	std::vector<plane> planes;
+	std::vector<sphere> spheres;
+	std::chrono::steady_clock::time_point next_due;
+};
+
+#endif